@@ -4,30 +4,46 @@
 #include <asio.hpp>
 #include <ostream>
 
+// IPv4 addresses received on a dual stack socket come mapped into IPv6,
+// this turns them back so that they compare equal to the plain ones.
+inline asio::ip::address unmapped(const asio::ip::address &address) {
+  if (address.is_v6() && address.to_v6().is_v4_mapped())
+    return asio::ip::make_address_v4(asio::ip::v4_mapped, address.to_v6());
+  return address;
+}
+
+// Opens socket for IPv6 and IPv4 alike, or for IPv4 only on hosts without
+// IPv6. Returns the protocol it was opened for.
+inline asio::ip::udp open_dual_stack(asio::ip::udp::socket &socket) {
+  asio::error_code ec;
+  socket.open(asio::ip::udp::v6(), ec);
+  if (!ec)
+    socket.set_option(asio::ip::v6_only{false}, ec);
+  if (!ec)
+    return asio::ip::udp::v6();
+  socket.close(ec);
+  socket.open(asio::ip::udp::v4());
+  return asio::ip::udp::v4();
+}
+
 struct Address {
-  explicit Address(const asio::ip::tcp::endpoint &endpoint) {
-    const auto address = endpoint.address().to_v4().to_bytes();
-    ip[0] = address[0];
-    ip[1] = address[1];
-    ip[2] = address[2];
-    ip[3] = address[3];
-    port = endpoint.port();
-  }
-
-  int ip[4];
+  // of a TCP or UDP endpoint
+  template <typename Endpoint>
+  explicit Address(const Endpoint &endpoint)
+      : ip{unmapped(endpoint.address())}, port{endpoint.port()} {}
+
+  asio::ip::address ip;
   int port;
 };
 
 constexpr const char *const MOTOR_TCP_PORT = "1333";
-constexpr int VIDEO_UDP_PORT = 1512;
 constexpr int SENSOR_UDP_PORT = 1666;
 
 inline std::ostream &operator<<(std::ostream &out, const Address &adr) {
-  out << adr.ip[0] << '.';
-  out << adr.ip[1] << '.';
-  out << adr.ip[2] << '.';
-  out << adr.ip[3] << ':';
-  out << adr.port;
+  if (adr.ip.is_v6())
+    out << '[' << adr.ip.to_string() << "]:" << adr.port;
+  else
+    out << adr.ip.to_string() << ':' << adr.port;
   return out;
 }
 
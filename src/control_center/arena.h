@@ -0,0 +1,46 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Bump allocator for memory that lives until the next reset. Requests that
+// don't fit get blocks of their own, on reset the arena grows to fit all of
+// them, so a steady workload stops touching the heap after the first round.
+class Arena {
+private:
+  std::unique_ptr<std::byte[]> block;
+  size_t capacity{0};
+  size_t used{0};
+  size_t requested{0}; // bytes needed since the last reset
+  std::vector<std::unique_ptr<std::byte[]>> overflow;
+
+public:
+  // Invalidates everything that was allocated.
+  void reset() {
+    if (!overflow.empty()) {
+      overflow.clear();
+      capacity = requested;
+      block = std::make_unique<std::byte[]>(capacity);
+    }
+    used = 0;
+    requested = 0;
+  }
+
+  template <typename T> T *allocate(size_t count) {
+    const size_t size = count * sizeof(T);
+    requested += size + alignof(T);
+    const size_t offset = (used + alignof(T) - 1) / alignof(T) * alignof(T);
+    if (offset + size <= capacity) {
+      used = offset + size;
+      return reinterpret_cast<T *>(block.get() + offset);
+    }
+    overflow.push_back(std::make_unique<std::byte[]>(size));
+    return reinterpret_cast<T *>(overflow.back().get());
+  }
+
+  size_t size() const { return capacity; }
+};
+
+#endif
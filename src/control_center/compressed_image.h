@@ -0,0 +1,11 @@
+#ifndef COMPRESSED_IMAGE_H
+#define COMPRESSED_IMAGE_H
+
+#include <memory>
+
+struct CompressedImage {
+  std::unique_ptr<unsigned char[]> data;
+  size_t size;
+};
+
+#endif
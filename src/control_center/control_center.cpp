@@ -1,139 +1,97 @@
 #include <asio.hpp>
-#include <functional>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <exception>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <vector>
 
+#include "controller.h"
 #include "gui_context.h"
-#include "motor_data.h"
-#include "receiving_loop.h"
-#include "sensor_data.h"
-#include "texture_update_data.h"
-#include "timer_loop.h"
-#include "transmitter.h"
-#include "ui.h"
-
-using tcp = asio::ip::tcp;
-using udp = asio::ip::udp;
-
-int main(int, char **) {
-  asio::io_context ctx;
-
-  Transmitter transmitter{ctx};
-  MotorData motor_data{};
-  TimerLoop transmission_loop{asio::steady_timer{ctx},
-                              std::chrono::milliseconds{100},
-                              [&transmitter, &motor_data]() {
-                                transmitter.async_send(motor_data, [](...) {});
-                              }};
-
-  // This has to be static and the reason why is rather interesting.
-  // This address is changed inside the transmitter.async_connect callback.
-  // That callback runs on a different thread. For some reason
-  // the address space on that thread is different from that of the main
-  // thread, despite the fact that it should be the same.
-  // So, if the address was not static, it couldn't get modified in any
-  // way from the worker thread. I don't know what causes that nor how to
-  // fix it. TODO: figure this out.
-  static std::optional<Address> address{};
-
-  GUIContext gui_ctx{23.0f};
-
-  SensorData sensor_data;
-  auto camera_view = gui_ctx.create_texture(1280, 720);
-  UI ui{address, camera_view, sensor_data};
-
-  TextureUpdateData update_data{camera_view};
-  int current_frame_number{}; // TODO: wrap in frame stats
-  ReceivingLoop video_receiving_loop{
-      udp::socket{ctx,
-                  udp::endpoint{asio::ip::address_v4::any(), VIDEO_UDP_PORT}},
-      [&current_frame_number, &update_data]() {
-        return std::array{
-            asio::buffer(&current_frame_number, sizeof(current_frame_number)),
-            update_data.begin_receiving_data()};
-      },
-      [&update_data](asio::error_code ec, std::size_t bytes_received,
-                     const udp::endpoint & /*sender*/) {
-        update_data.end_receiving_data(bytes_received);
-      }};
-
-  struct Message { // TODO: refactor
-    double water_temperature;
-    double turbidity;
-    double dust;
-    double battery_voltage;
-    double pressure;
-    double temperature;
-    double humidity;
-  } message;
-  ReceivingLoop sensor_receiving_loop{
-      udp::socket{ctx,
-                  udp::endpoint{asio::ip::address_v4::any(), SENSOR_UDP_PORT}},
-      [&message]() { return asio::buffer(&message, sizeof(message)); },
-      [&message, &sensor_data](asio::error_code ec, std::size_t bytes_received,
-                               const udp::endpoint & /*sender*/) {
-        // TODO: receive timestamp
-        sensor_data.add_reading(SensorType::WaterTemperature, 0,
-                                message.water_temperature);
-        sensor_data.add_reading(SensorType::WaterTurbidity, 0,
-                                message.turbidity);
-        sensor_data.add_reading(SensorType::Dust, 0, message.dust);
-        sensor_data.add_reading(SensorType::BatteryVoltage, 0,
-                                message.battery_voltage);
-        sensor_data.add_reading(SensorType::AtmosphericPressure, 0,
-                                message.pressure);
-        sensor_data.add_reading(SensorType::AtmosphericTemperature, 0,
-                                message.temperature);
-        sensor_data.add_reading(SensorType::AtmosphericHumidity, 0,
-                                message.humidity);
-      }};
-
-  Controller controller;
-
-  std::vector<std::thread> workers;
-  {
-    asio::io_context::work work{ctx};
-    const int worker_count = 4;
-    for (int i = 0; i < worker_count; ++i) {
-      workers.emplace_back([&ctx] {
-        ctx.run();
-      });
+#include "io_thread.h"
+#include "options.h"
+#include "session_demux.h"
+#include "vehicle_session.h"
+#include "worker_pool.h"
+
+int main(int argc, char **argv) {
+  try {
+    const Options options = parse_options(argc, argv);
+    // Every subsystem runs its handlers on a thread of its own, so that a burst
+    // of video datagrams can't hold up a motor command.
+    IoThread video_thread{"video", options.video_cpu};
+    IoThread telemetry_thread{"telemetry", options.telemetry_cpu};
+    IoThread control_thread{"control", options.control_cpu,
+                            options.control_priority};
+
+    GUIContext gui_ctx{23.0f};
+
+    // The GUI thread takes part in decoding as well. The streams are decoded
+    // one after the other, each frame across the whole pool.
+    WorkerPool decode_pool{std::max(std::thread::hardware_concurrency(), 1u) -
+                           1};
+    std::vector<std::unique_ptr<VehicleSession>> sessions;
+    std::optional<SessionDemux> demux;
+    // The handlers use the sessions, the threads are stopped before those
+    // go, also when setting them up fails.
+    struct ThreadsStopper {
+      std::array<IoThread *, 3> threads;
+      ~ThreadsStopper() {
+        for (auto *thread : threads)
+          thread->stop();
+      }
+    } threads_stopper{{&control_thread, &telemetry_thread, &video_thread}};
+
+    for (int i = 0; i < options.vehicles; ++i) {
+      sessions.push_back(std::make_unique<VehicleSession>(
+          i, options, video_thread, control_thread, gui_ctx, decode_pool));
+      sessions.back()->set_thread_layout({video_thread.layout(),
+                                          telemetry_thread.layout(),
+                                          control_thread.layout()});
     }
+    demux.emplace(sessions, options.video_streams, options.receive_batch,
+                  video_thread.context(), telemetry_thread.context());
+
+    Controller controller;
+    int driven_vehicle = 0; // by the gamepad
+    // when the next frame of a shown stream is due
+    auto next_frame_time = [&sessions] {
+      auto time = std::chrono::steady_clock::time_point::max();
+      for (const auto &session : sessions)
+        time = std::min(time, session->next_frame_time());
+      return time;
+    };
 
     while (!gui_ctx.should_close()) {
-      gui_ctx.pollEvents([&motor_data, &controller](const SDL_Event &event) {
-        if (event.type == SDL_CONTROLLERAXISMOTION) {
-          motor_data.left_speed = std::clamp(-controller.left_y(), 0.0f, 1.0f);
-          motor_data.right_speed =
-              std::clamp(-controller.right_y(), 0.0f, 1.0f);
-        }
-      });
-
-      gui_ctx.update_texture(camera_view, update_data.data());
-
-      // ui.set_frame_stats(receiving_loop.last_frame_stats()); TODO:
-      // reimplement frame stats
-
-      gui_ctx.render([&ui, &motor_data, &transmitter] {
-        ui.update(motor_data, [&transmitter, &ui](std::string_view host,
-                                                  std::string_view service) {
-          address = std::nullopt;
-          transmitter.async_connect(
-              host, service,
-              [](asio::error_code ec, const tcp::endpoint &endpoint) {
-                if (!ec)
-                  address = Address{endpoint};
-                else
-                  address = std::nullopt;
-              });
-        });
+      gui_ctx.pollEvents(
+          [&controller, &sessions, &driven_vehicle](const SDL_Event &event) {
+            if (event.type == SDL_CONTROLLERAXISMOTION) {
+              // sent right away, not after the frame
+              sessions[driven_vehicle]->drive(
+                  std::clamp(-controller.left_y(), 0.0f, 1.0f),
+                  std::clamp(-controller.right_y(), 0.0f, 1.0f));
+            }
+          },
+          next_frame_time());
+
+      // while the window is hidden, frames are only decoded when it is
+      // checked on, not whenever one is due
+      const bool decode = gui_ctx.decode_due();
+      for (auto &session : sessions)
+        if (session->update(decode))
+          gui_ctx.request_frame();
+
+      gui_ctx.render([&sessions, &driven_vehicle] {
+        for (auto &session : sessions)
+          session->draw(driven_vehicle);
       });
     }
+  } catch (const std::exception &e) {
+    // bad options, or a memory budget too small for what was asked for
+    std::cerr << "Error: " << e.what() << '\n';
+    return 1;
   }
-
-  ctx.stop(); // TODO: this shouldn't be neccesary (~work should suffice)
-  for (auto &worker : workers) {
-    worker.join();
-  }
-
   return 0;
-}
\ No newline at end of file
+}
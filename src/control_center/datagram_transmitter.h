@@ -0,0 +1,90 @@
+#ifndef DATAGRAM_TRANSMITTER_H
+#define DATAGRAM_TRANSMITTER_H
+
+#include <asio.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// Sends datagrams to a host that is resolved like the Transmitter's, and
+// receives the datagrams it sends back. Nothing is queued: a datagram that
+// doesn't fit into the socket buffer is dropped, a newer one follows soon
+// and a lost one doesn't hold up the ones after it. Datagrams sent while not
+// connected are discarded.
+class DatagramTransmitter {
+private:
+  using udp = asio::ip::udp;
+  asio::strand<asio::io_context::executor_type> strand;
+  udp::resolver resolver;
+  udp::socket socket;
+  std::atomic<uint64_t> dropped_datagrams{0};
+
+public:
+  DatagramTransmitter(asio::io_context &ctx)
+      : strand{asio::make_strand(ctx)}, resolver{strand}, socket{strand} {}
+
+  template <typename F>
+  void async_connect(std::string_view host, std::string_view service,
+                     F &&handler) {
+    asio::post(strand, [this, host = std::string{host},
+                        service = std::string{service},
+                        handler = std::forward<F>(handler)]() mutable {
+      asio::error_code ec;
+      socket.close(ec);
+      resolver.cancel();
+      resolver.async_resolve(
+          host, service,
+          [this, handler = std::move(handler)](
+              asio::error_code ec,
+              udp::resolver::results_type results) mutable {
+            if (!ec && results.empty())
+              ec = asio::error::host_not_found;
+            if (!ec)
+              socket.open(results.begin()->endpoint().protocol(), ec);
+            if (!ec)
+              socket.connect(*results.begin(), ec);
+            if (!ec)
+              socket.non_blocking(true, ec);
+            if (ec) {
+              asio::error_code ignored;
+              socket.close(ignored);
+              handler(ec, udp::endpoint{});
+              return;
+            }
+            handler(ec, socket.remote_endpoint());
+          });
+    });
+  }
+
+  // Sends a copy of pod, can be called from any thread. Only the first
+  // pod.size() bytes are sent if it has a size().
+  template <typename T> void send(const T &pod) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    asio::post(strand, [this, pod] {
+      if (!socket.is_open())
+        return;
+      size_t bytes = sizeof(pod);
+      if constexpr (requires { pod.size(); })
+        bytes = pod.size();
+      asio::error_code ec;
+      socket.send(asio::buffer(&pod, bytes), 0, ec);
+      if (ec == asio::error::would_block)
+        dropped_datagrams.fetch_add(1, std::memory_order_relaxed);
+    });
+  }
+  template <typename T, typename F> void async_receive(T &pod, F &&handler) {
+    asio::post(strand, [this, &pod, handler = std::forward<F>(handler)] {
+      socket.async_receive(asio::buffer(&pod, sizeof(pod)), handler);
+    });
+  }
+
+  // datagrams dropped because the socket buffer was full
+  uint64_t dropped() const {
+    return dropped_datagrams.load(std::memory_order_relaxed);
+  }
+};
+
+#endif
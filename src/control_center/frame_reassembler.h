@@ -0,0 +1,170 @@
+#ifndef FRAME_REASSEMBLER_H
+#define FRAME_REASSEMBLER_H
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <span>
+#include <vector>
+
+#include "compressed_image.h"
+#include "video_packet.h"
+
+enum class FragmentStatus {
+  Malformed,
+  Duplicate, // of a fragment that was already received
+  Reordered, // belongs to a frame older than the last completed one
+  Accepted,
+  Completed, // completed its frame
+};
+
+class FrameReassembler {
+public:
+  // Frames that are still being received. A small pool is enough to absorb
+  // fragments of consecutive frames arriving interleaved.
+  static constexpr size_t slot_count = 4;
+  // Fragments further behind the last completed frame than this can't be
+  // late, the sender must have started over with its frame ids.
+  static constexpr uint32_t max_reorder_frames = 64;
+
+private:
+  struct Slot {
+    CompressedImage image;
+    std::vector<bool> received;
+    uint32_t frame_id;
+    uint16_t fragment_count;
+    uint16_t fragments_received;
+    bool in_use;
+  };
+
+  const size_t frame_capacity;
+  const size_t max_fragment_count;
+  std::array<Slot, slot_count> slots;
+
+  FragmentHeader header;
+
+  bool has_completed{false};
+  uint32_t last_completed{};
+
+  // frame ids wrap around, compare them in serial number arithmetic
+  static bool is_newer(uint32_t a, uint32_t b) {
+    return static_cast<int32_t>(a - b) > 0;
+  }
+
+  Slot *find_slot(uint32_t frame_id) {
+    for (auto &slot : slots)
+      if (slot.in_use && slot.frame_id == frame_id)
+        return &slot;
+
+    Slot *victim = nullptr;
+    for (auto &slot : slots) {
+      if (!slot.in_use) {
+        victim = &slot;
+        break;
+      }
+      if (!victim || is_newer(victim->frame_id, slot.frame_id))
+        victim = &slot;
+    }
+    // the oldest partial frame gets evicted when the pool is exhausted
+    if (victim->in_use && is_newer(victim->frame_id, frame_id))
+      return nullptr;
+
+    victim->in_use = true;
+    victim->frame_id = frame_id;
+    victim->fragment_count = header.fragment_count;
+    victim->fragments_received = 0;
+    victim->image.size = header.frame_size;
+    std::fill_n(victim->received.begin(), header.fragment_count, false);
+    return victim;
+  }
+
+  void evict_older_than(uint32_t frame_id) {
+    for (auto &slot : slots)
+      if (slot.in_use && !is_newer(slot.frame_id, frame_id))
+        slot.in_use = false;
+  }
+
+public:
+  FrameReassembler(size_t frame_capacity)
+      : frame_capacity{frame_capacity},
+        max_fragment_count{std::min<size_t>(
+            (frame_capacity + MAX_FRAGMENT_PAYLOAD_SZ - 1) /
+                MAX_FRAGMENT_PAYLOAD_SZ,
+            UINT16_MAX)} {
+    for (auto &slot : slots) {
+      slot.image = {std::make_unique<unsigned char[]>(frame_capacity), 0};
+      slot.received.resize(max_fragment_count);
+      slot.in_use = false;
+    }
+  }
+
+  // Forgets all frames, the next one is taken whatever its id.
+  void reset() {
+    has_completed = false;
+    for (auto &slot : slots)
+      slot.in_use = false;
+  }
+
+  // Whether the fragment in datagram is so far behind the last completed
+  // frame that the sender must have started over, the reassembler should be
+  // reset then.
+  bool starts_over(std::span<const unsigned char> datagram) const {
+    FragmentHeader next;
+    if (!has_completed || datagram.size() < sizeof(next))
+      return false;
+    std::memcpy(&next, datagram.data(), sizeof(next));
+    return is_newer(last_completed, next.frame_id) &&
+           last_completed - next.frame_id > max_reorder_frames;
+  }
+
+  // header of the fragment received last
+  const FragmentHeader &fragment_header() const { return header; }
+
+  // Copies the fragment in datagram into its frame. on_frame_complete is
+  // called with the finished frame and the header of its last fragment, it
+  // may swap the frame's buffer out for another one of the same capacity.
+  template <typename F>
+  FragmentStatus receive_fragment(std::span<const unsigned char> datagram,
+                                  F &&on_frame_complete) {
+    if (datagram.size() < sizeof(header))
+      return FragmentStatus::Malformed;
+    std::memcpy(&header, datagram.data(), sizeof(header));
+    const size_t payload_size = datagram.size() - sizeof(header);
+    if (header.fragment_count == 0 ||
+        header.fragment_count > max_fragment_count ||
+        header.fragment_index >= header.fragment_count ||
+        header.frame_size > frame_capacity ||
+        header.offset > header.frame_size ||
+        payload_size > header.frame_size - header.offset)
+      return FragmentStatus::Malformed;
+
+    // frames older than the last completed one would be shown out of order
+    if (has_completed && header.frame_id == last_completed)
+      return FragmentStatus::Duplicate;
+    if (has_completed && !is_newer(header.frame_id, last_completed))
+      return FragmentStatus::Reordered;
+
+    Slot *slot = find_slot(header.frame_id);
+    if (!slot)
+      return FragmentStatus::Reordered;
+    if (slot->fragment_count != header.fragment_count ||
+        slot->image.size != header.frame_size)
+      return FragmentStatus::Malformed;
+    if (slot->received[header.fragment_index])
+      return FragmentStatus::Duplicate;
+
+    std::memcpy(slot->image.data.get() + header.offset,
+                datagram.data() + sizeof(header), payload_size);
+    slot->received[header.fragment_index] = true;
+    if (++slot->fragments_received != slot->fragment_count)
+      return FragmentStatus::Accepted;
+
+    on_frame_complete(slot->image, header);
+    has_completed = true;
+    last_completed = slot->frame_id;
+    evict_older_than(last_completed);
+    return FragmentStatus::Completed;
+  }
+};
+
+#endif
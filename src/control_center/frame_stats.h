@@ -2,10 +2,21 @@
 #define FRAME_STATS_H
 
 #include <chrono>
+#include <cstdint>
 
 struct FrameStats {
-  std::chrono::steady_clock::duration frametime;
-  size_t framesize;
+  std::chrono::steady_clock::duration frametime; // mean time between frames
+  std::chrono::steady_clock::duration jitter;    // of the time between frames
+  std::chrono::steady_clock::duration decode_time;
+  std::chrono::steady_clock::duration playout_delay;
+  size_t framesize; // mean compressed size
+  double bytes_per_second;
+  // totals since the stream started
+  uint64_t frames_received;
+  uint64_t frames_lost;
+  uint64_t frames_duplicated;
+  uint64_t frames_reordered;
+  uint64_t frames_skipped; // by the playout buffer
 };
 
-#endif
\ No newline at end of file
+#endif
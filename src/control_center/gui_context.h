@@ -6,6 +6,9 @@
 #include <imgui_freetype.h>
 #include <imgui_impl_sdl.h>
 #include <imgui_impl_sdlrenderer.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <implot.h>
 #include <memory>
 #include <stdexcept>
@@ -118,11 +121,60 @@ private:
   }
 
 private:
+  using clock = std::chrono::steady_clock;
+  // without new input or data the GUI is still redrawn this often, which
+  // keeps the statistics and plots current
+  static constexpr clock::duration idle_interval =
+      std::chrono::milliseconds{100};
+  // and only checked this often while the window is minimized or hidden
+  static constexpr clock::duration hidden_interval =
+      std::chrono::milliseconds{500};
+  // ImGui takes a few frames to settle after input, e.g. to show hovering
+  static constexpr int frames_after_input = 3;
+
   SDL_Window *window;
   SDL_Renderer *renderer;
   bool m_should_close = false;
+  Uint32 wake_event;
+  std::atomic<bool> wake_pending{false};
+  std::atomic<bool> hidden{false}; // wake() does nothing then
+  int frames_to_render = frames_after_input;
+  clock::time_point last_render{};
+
+  bool visible() const {
+    return !(SDL_GetWindowFlags(window) &
+             (SDL_WINDOW_MINIMIZED | SDL_WINDOW_HIDDEN));
+  }
+  // the longest the loop may sleep before the next frame is due
+  clock::duration time_to_next_frame() const {
+    if (frames_to_render > 0)
+      return {};
+    const auto interval = visible() ? idle_interval : hidden_interval;
+    return std::max(last_render + interval - clock::now(), clock::duration{});
+  }
+  template <typename F> void handle_event(const SDL_Event &event, F &handler) {
+    if (event.type == wake_event) {
+      wake_pending.store(false, std::memory_order_relaxed);
+      frames_to_render = std::max(frames_to_render, 1);
+      return;
+    }
+    frames_to_render = frames_after_input;
+    ImGui_ImplSDL2_ProcessEvent(&event);
+    if (event.type == SDL_QUIT)
+      m_should_close = true;
+    if (event.type == SDL_WINDOWEVENT &&
+        event.window.event == SDL_WINDOWEVENT_CLOSE &&
+        event.window.windowID == SDL_GetWindowID(window))
+      m_should_close = true;
+    handler(event);
+  }
 
 public:
+  enum class PixelFormat {
+    RGBA,
+    YUV, // planar 4:2:0, converted to RGB by the renderer
+  };
+
   class Texture {
   private:
     friend class GUIContext;
@@ -130,17 +182,64 @@ public:
       SDL_DestroyTexture(ptr);
     };
 
-    Texture(SDL_Texture *ptr, size_t width, size_t height)
-        : _ptr{ptr, texture_deleter}, _width{width}, _height{height} {}
+    Texture(SDL_Texture *ptr, size_t width, size_t height, PixelFormat format)
+        : _ptr{ptr, texture_deleter}, _width{width}, _height{height},
+          _format{format} {}
 
   public:
+    // Write access to the texture memory, unlocks the texture when destroyed.
+    // The previous contents of a locked streaming texture are undefined, so
+    // all pixels of the locked area have to be written.
+    class Lock {
+    private:
+      friend class Texture;
+      Lock(SDL_Texture *texture, const SDL_Rect *rect) : texture{texture} {
+        if (SDL_LockTexture(texture, rect, &_pixels, &_pitch))
+          throw std::runtime_error("Could not lock texture");
+      }
+
+    public:
+      Lock(const Lock &) = delete;
+      Lock &operator=(const Lock &) = delete;
+      ~Lock() { SDL_UnlockTexture(texture); }
+
+      unsigned char *pixels() const {
+        return static_cast<unsigned char *>(_pixels);
+      }
+      size_t pitch() const { return _pitch; }
+
+    private:
+      SDL_Texture *texture;
+      void *_pixels;
+      int _pitch;
+    };
+
     ImTextureID handle() const { return _ptr.get(); }
     size_t width() const { return _width; };
     size_t height() const { return _height; };
+    PixelFormat format() const { return _format; }
+    Lock lock() const { return Lock{_ptr.get(), nullptr}; }
+    // locks the top left width x height pixels only
+    Lock lock(size_t width, size_t height) const {
+      const SDL_Rect rect{0, 0, static_cast<int>(width),
+                          static_cast<int>(height)};
+      return Lock{_ptr.get(), &rect};
+    }
+    // Uploads the planes of the top left width x height pixels of a YUV
+    // texture, u and v have half the resolution.
+    void update_yuv(size_t width, size_t height, const unsigned char *y,
+                    size_t y_pitch, const unsigned char *u, size_t u_pitch,
+                    const unsigned char *v, size_t v_pitch) const {
+      const SDL_Rect rect{0, 0, static_cast<int>(width),
+                          static_cast<int>(height)};
+      SDL_UpdateYUVTexture(_ptr.get(), &rect, y, y_pitch, u, u_pitch, v,
+                           v_pitch);
+    }
 
   private:
     std::unique_ptr<SDL_Texture, decltype(texture_deleter)> _ptr;
     size_t _width, _height;
+    PixelFormat _format;
   };
 
 public:
@@ -161,6 +260,9 @@ public:
         window, -1, SDL_RENDERER_PRESENTVSYNC | SDL_RENDERER_ACCELERATED);
     if (!renderer)
       throw std::runtime_error("Couldn't create SDL renderer");
+    wake_event = SDL_RegisterEvents(1);
+    if (wake_event == static_cast<Uint32>(-1))
+      throw std::runtime_error("Couldn't register SDL event");
 
     // Initialize ImGui
     IMGUI_CHECKVERSION();
@@ -197,20 +299,54 @@ public:
     SDL_DestroyWindow(window);
     SDL_Quit();
   }
-  template <typename F> void pollEvents(F &&handler) {
+  // Sleeps until there is input, wake() is called, wake_at has come or the
+  // next frame is due anyway, then handles all pending events. wake_at is
+  // ignored while the window is minimized or hidden, like wake().
+  template <typename F>
+  void pollEvents(F &&handler,
+                  clock::time_point wake_at = clock::time_point::max()) {
     SDL_Event event;
-    while (SDL_PollEvent(&event)) {
-      ImGui_ImplSDL2_ProcessEvent(&event);
-      if (event.type == SDL_QUIT)
-        m_should_close = true;
-      if (event.type == SDL_WINDOWEVENT &&
-          event.window.event == SDL_WINDOWEVENT_CLOSE &&
-          event.window.windowID == SDL_GetWindowID(window))
-        m_should_close = true;
-      handler(event);
-    }
+    if (!visible())
+      wake_at = clock::time_point::max();
+    const auto now = clock::now();
+    const auto until_wake_at =
+        wake_at > now ? wake_at - now : clock::duration{};
+    const auto timeout = std::chrono::ceil<std::chrono::milliseconds>(
+        std::min(time_to_next_frame(), until_wake_at));
+    if (timeout.count() > 0 &&
+        SDL_WaitEventTimeout(&event, static_cast<int>(timeout.count())))
+      handle_event(event, handler);
+    while (SDL_PollEvent(&event))
+      handle_event(event, handler);
+    hidden.store(!visible(), std::memory_order_relaxed);
+  }
+  // Makes pollEvents return and the next render draw, e.g. for a new video
+  // frame, unless the window is hidden. Can be called from any thread.
+  void wake() {
+    if (hidden.load(std::memory_order_relaxed) ||
+        wake_pending.exchange(true, std::memory_order_relaxed))
+      return;
+    SDL_Event event{};
+    event.type = wake_event;
+    SDL_PushEvent(&event);
+  }
+  // makes the next render draw, from the GUI thread
+  void request_frame() { frames_to_render = std::max(frames_to_render, 1); }
+  // Whether video should be decoded now: always while the window is shown,
+  // only when the next frame is due while it is minimized or hidden.
+  bool decode_due() const {
+    return visible() || time_to_next_frame() == clock::duration{};
   }
-  template <typename F> void render(F &&gui_func) {
+  // Draws a frame if one is due, returns whether it did. Nothing is drawn
+  // while the window is minimized or hidden.
+  template <typename F> bool render(F &&gui_func) {
+    if (time_to_next_frame() > clock::duration{})
+      return false;
+    last_render = clock::now();
+    frames_to_render = std::max(frames_to_render - 1, 0);
+    if (!visible())
+      return false;
+
     ImGui_ImplSDLRenderer_NewFrame();
     ImGui_ImplSDL2_NewFrame(window);
     ImGui::NewFrame();
@@ -226,29 +362,34 @@ public:
     SDL_RenderClear(renderer);
     ImGui_ImplSDLRenderer_RenderDrawData(ImGui::GetDrawData());
     SDL_RenderPresent(renderer);
+    return true;
   }
   bool should_close() const { return m_should_close; }
 
   struct Pixel {
     unsigned char r, g, b, a;
   };
-  Texture create_texture(size_t width, size_t height) {
-    SDL_Texture *id =
-        SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32,
-                          SDL_TEXTUREACCESS_STREAMING, width, height);
+  Texture create_texture(size_t width, size_t height,
+                         PixelFormat format = PixelFormat::RGBA) {
+    // JPEG images use full range YCbCr
+    if (format == PixelFormat::YUV)
+      SDL_SetYUVConversionMode(SDL_YUV_CONVERSION_JPEG);
+    SDL_Texture *id = SDL_CreateTexture(
+        renderer,
+        format == PixelFormat::YUV ? SDL_PIXELFORMAT_IYUV
+                                   : SDL_PIXELFORMAT_RGBA32,
+        SDL_TEXTUREACCESS_STREAMING, width, height);
     if (!id)
       throw std::runtime_error("Could not create texture");
-    SDL_SetTextureBlendMode(id, SDL_BLENDMODE_BLEND);
+    if (format == PixelFormat::RGBA)
+      SDL_SetTextureBlendMode(id, SDL_BLENDMODE_BLEND);
 
-    return Texture{id, width, height};
-  }
-  void update_texture(const Texture &texture, Pixel *data) {
-    SDL_UpdateTexture(texture._ptr.get(), NULL, static_cast<void *>(data),
-                      sizeof(Pixel) * texture.width());
+    return Texture{id, width, height, format};
   }
 };
 
 using Texture = GUIContext::Texture;
 using Pixel = GUIContext::Pixel;
+using PixelFormat = GUIContext::PixelFormat;
 
 #endif
\ No newline at end of file
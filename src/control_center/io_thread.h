@@ -0,0 +1,94 @@
+#ifndef IO_THREAD_H
+#define IO_THREAD_H
+
+#include <asio.hpp>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// An io_context with a thread of its own, so that the handlers of one
+// subsystem never wait behind those of another. The thread can be pinned to
+// a CPU and given a SCHED_FIFO priority. Both are best effort: if the system
+// refuses, the thread keeps running without and layout() says so.
+class IoThread {
+private:
+  std::string name;
+  asio::io_context ctx{1}; // the thread is the only one running handlers
+  asio::executor_work_guard<asio::io_context::executor_type> work{
+      asio::make_work_guard(ctx)};
+  std::thread thread;
+  std::string description;
+
+  void configure(std::optional<int> cpu, std::optional<int> fifo_priority) {
+    std::ostringstream out;
+    out << name << ": ";
+#ifdef __linux__
+    const auto handle = thread.native_handle();
+    pthread_setname_np(handle, name.substr(0, 15).c_str());
+    if (cpu) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(*cpu, &set);
+      const int error = pthread_setaffinity_np(handle, sizeof(set), &set);
+      if (error)
+        report("pin to CPU " + std::to_string(*cpu), error);
+      out << (error ? "any CPU" : "CPU " + std::to_string(*cpu));
+    } else {
+      out << "any CPU";
+    }
+    if (fifo_priority) {
+      sched_param param{};
+      param.sched_priority = *fifo_priority;
+      const int error = pthread_setschedparam(handle, SCHED_FIFO, &param);
+      if (error)
+        report("use SCHED_FIFO", error);
+      out << (error ? ", normal priority"
+                    : ", SCHED_FIFO " + std::to_string(*fifo_priority));
+    } else {
+      out << ", normal priority";
+    }
+#else
+    if (cpu || fifo_priority)
+      std::cerr << "Pinning and priorities are only supported on Linux\n";
+    out << "any CPU, normal priority";
+#endif
+    description = out.str();
+  }
+
+  void report(const std::string &what, int error) {
+    std::cerr << "Could not " << what << " for the " << name
+              << " thread: " << std::strerror(error) << '\n';
+  }
+
+public:
+  IoThread(std::string name, std::optional<int> cpu = std::nullopt,
+           std::optional<int> fifo_priority = std::nullopt)
+      : name{std::move(name)}, thread{[this] { ctx.run(); }} {
+    configure(cpu, fifo_priority);
+  }
+  IoThread(const IoThread &) = delete;
+  IoThread &operator=(const IoThread &) = delete;
+  ~IoThread() { stop(); }
+
+  asio::io_context &context() { return ctx; }
+  const std::string &layout() const { return description; }
+
+  // Has to be called before the objects that use the context are destroyed.
+  void stop() {
+    if (!thread.joinable())
+      return;
+    work.reset();
+    ctx.stop();
+    thread.join();
+  }
+};
+
+#endif
@@ -0,0 +1,665 @@
+#ifndef JPEG_DECODER_H
+#define JPEG_DECODER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+#include "arena.h"
+#include "jpeg_layout.h"
+#include "restart_bands.h"
+#include "worker_pool.h"
+
+// Decodes baseline JPEG images either into RGBA rows or into separate Y, Cb
+// and Cr planes with 4:2:0 chroma. RGBA output interpolates the chroma
+// linearly, like jpgd does by default, unless it is asked to point sample.
+// Bands between restart markers are decoded in parallel. The decoder is
+// meant to be kept around for a whole stream: it only rebuilds tables that
+// changed and takes its planes from an arena, so once the first frame is
+// through decoding doesn't allocate. jpgd only hands out RGBA scan lines,
+// with the chroma already upsampled and converted, so it can't feed a YUV
+// texture. jpeg_decoder_test checks that both decode frames alike.
+class JpegDecoder {
+public:
+  struct Plane {
+    const unsigned char *data;
+    size_t pitch;
+  };
+  // how RGBA output brings subsampled chroma up to the luma resolution
+  enum class ChromaFilter { Nearest, Linear };
+
+private:
+  static constexpr size_t max_components = 3;
+  static constexpr uint8_t zigzag[64] = {
+      0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,
+      12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28,
+      35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+      58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
+  struct HuffmanTable {
+    static constexpr int fast_bits = 9;
+    // (code length << 8) | symbol for codes of up to fast_bits bits, else 0
+    uint16_t fast[1 << fast_bits];
+    int32_t max_code[17]; // largest code of each length, -1 if there is none
+    int32_t offset[17];   // index of a code's symbol minus the code
+    uint8_t symbols[256];
+    // DHT contents the table was built from
+    unsigned char source[16 + 256];
+    size_t source_size{0};
+    bool defined;
+
+    // Returns false, and leaves the table undefined, if the codes don't fit
+    // their lengths.
+    bool build(const unsigned char counts[16],
+               std::span<const unsigned char> values) {
+      defined = false;
+      if (source_size == 16 + values.size() &&
+          std::memcmp(source, counts, 16) == 0 &&
+          std::memcmp(source + 16, values.data(), values.size()) == 0) {
+        defined = true;
+        return true;
+      }
+      source_size = 0;
+
+      std::copy(values.begin(), values.end(), symbols);
+      std::fill_n(fast, 1 << fast_bits, 0);
+      int32_t code = 0;
+      int32_t k = 0;
+      for (int length = 1; length <= 16; ++length) {
+        if (code + counts[length - 1] > (1 << length))
+          return false; // more codes than fit in length bits
+        offset[length] = k - code;
+        for (int i = 0; i < counts[length - 1]; ++i, ++k, ++code) {
+          if (length > fast_bits)
+            continue;
+          const int shift = fast_bits - length;
+          std::fill_n(fast + (code << shift), 1 << shift,
+                      static_cast<uint16_t>(length << 8 | symbols[k]));
+        }
+        max_code[length] = counts[length - 1] ? code - 1 : -1;
+        code <<= 1;
+      }
+      std::memcpy(source, counts, 16);
+      std::memcpy(source + 16, values.data(), values.size());
+      source_size = 16 + values.size();
+      defined = true;
+      return true;
+    }
+  };
+
+  class BitReader {
+  private:
+    const unsigned char *p, *end;
+    uint64_t bits{0};
+    int count{0};
+
+  public:
+    BitReader(const unsigned char *begin, const unsigned char *end)
+        : p{begin}, end{end} {}
+    void restart(const unsigned char *begin, const unsigned char *new_end) {
+      p = begin;
+      end = new_end;
+      bits = 0;
+      count = 0;
+    }
+    // Buffers at least 57 bits. Once a marker is reached zeros are fed in.
+    void refill() {
+      while (count <= 56) {
+        uint64_t byte = 0;
+        if (p < end) {
+          byte = *p++;
+          if (byte == 0xFF) {
+            if (p < end && *p == 0x00) {
+              ++p; // stuffed zero
+            } else {
+              byte = 0;
+              end = --p;
+            }
+          }
+        }
+        bits |= byte << (56 - count);
+        count += 8;
+      }
+    }
+    uint32_t peek(int n) const {
+      return static_cast<uint32_t>(bits >> (64 - n));
+    }
+    void consume(int n) {
+      bits <<= n;
+      count -= n;
+    }
+  };
+
+  struct Component {
+    uint8_t id;
+    uint8_t h, v; // sampling factors
+    uint8_t quant_table;
+    uint8_t dc_table, ac_table;
+  };
+
+  WorkerPool &pool;
+  const ChromaFilter chroma_filter;
+  RestartBands bands;
+
+  uint16_t quant[4][64]; // in natural order
+  // DQT contents the tables were built from
+  unsigned char quant_source[4][1 + 128];
+  size_t quant_source_size[4]{};
+  bool quant_defined[4];
+  HuffmanTable dc_tables[4], ac_tables[4];
+  Component components[max_components];
+  size_t component_count;
+  size_t max_h, max_v;
+
+  // component planes, padded to whole MCUs
+  Arena arena;
+  unsigned char *planes[max_components];
+  size_t pitches[max_components];
+  // 4:2:0 chroma, if the image uses some other subsampling
+  unsigned char *chroma[2];
+  size_t chroma_pitch;
+  bool direct_chroma;
+  // for linear filtering, the chroma samples under each pixel column as
+  // (sample << 8) | weight of the next sample
+  uint32_t *chroma_columns[2];
+
+  // the frame set up by prepare
+  std::span<const unsigned char> jpeg;
+  JpegLayout layout;
+
+  bool read_quant_tables(std::span<const unsigned char> segment) {
+    while (!segment.empty()) {
+      const size_t precision = segment[0] >> 4;
+      const size_t id = segment[0] & 0x0F;
+      const size_t size = 1 + 64 * (precision + 1);
+      if (id >= 4 || precision > 1 || segment.size() < size)
+        return false;
+      quant_defined[id] = true;
+      if (quant_source_size[id] == size &&
+          std::memcmp(quant_source[id], segment.data(), size) == 0) {
+        segment = segment.subspan(size);
+        continue;
+      }
+      for (size_t k = 0; k < 64; ++k)
+        quant[id][zigzag[k]] = precision ? read_u16_be(&segment[1 + 2 * k])
+                                         : segment[1 + k];
+      std::memcpy(quant_source[id], segment.data(), size);
+      quant_source_size[id] = size;
+      segment = segment.subspan(size);
+    }
+    return true;
+  }
+
+  bool read_huffman_tables(std::span<const unsigned char> segment) {
+    while (!segment.empty()) {
+      if (segment.size() < 17)
+        return false;
+      const size_t table_class = segment[0] >> 4;
+      const size_t id = segment[0] & 0x0F;
+      size_t value_count = 0;
+      for (size_t i = 0; i < 16; ++i)
+        value_count += segment[1 + i];
+      if (table_class > 1 || id >= 4 || value_count > 256 ||
+          segment.size() < 17 + value_count)
+        return false;
+      auto &table = table_class ? ac_tables[id] : dc_tables[id];
+      if (!table.build(&segment[1], segment.subspan(17, value_count)))
+        return false;
+      segment = segment.subspan(17 + value_count);
+    }
+    return true;
+  }
+
+  bool read_components(std::span<const unsigned char> segment) {
+    component_count = segment[5];
+    if (component_count != 1 && component_count != 3)
+      return false;
+    max_h = max_v = 1;
+    for (size_t i = 0; i < component_count; ++i) {
+      const unsigned char *c = &segment[6 + 3 * i];
+      auto &component = components[i];
+      component.id = c[0];
+      // a scan with a single component is never interleaved
+      component.h = component_count == 1 ? 1 : c[1] >> 4;
+      component.v = component_count == 1 ? 1 : c[1] & 0x0F;
+      component.quant_table = c[2];
+      if (component.h < 1 || component.h > 4 || component.v < 1 ||
+          component.v > 4 || component.quant_table >= 4)
+        return false;
+      max_h = std::max<size_t>(max_h, component.h);
+      max_v = std::max<size_t>(max_v, component.v);
+    }
+    return true;
+  }
+
+  bool read_scan(std::span<const unsigned char> segment) {
+    if (segment.size() < 4 + 2 * component_count)
+      return false;
+    for (size_t i = 0; i < component_count; ++i) {
+      const unsigned char *c = &segment[1 + 2 * i];
+      auto &component = components[i];
+      if (c[0] != component.id)
+        return false;
+      component.dc_table = c[1] >> 4;
+      component.ac_table = c[1] & 0x0F;
+      if (component.dc_table >= 4 || component.ac_table >= 4 ||
+          !dc_tables[component.dc_table].defined ||
+          !ac_tables[component.ac_table].defined ||
+          !quant_defined[component.quant_table])
+        return false;
+    }
+    const unsigned char *spectral = &segment[1 + 2 * component_count];
+    return spectral[0] == 0 && spectral[1] == 63 && spectral[2] == 0;
+  }
+
+  bool read_headers() {
+    std::fill_n(quant_defined, 4, false);
+    for (auto &table : dc_tables)
+      table.defined = false;
+    for (auto &table : ac_tables)
+      table.defined = false;
+
+    // parse_jpeg_layout already checked the segment structure
+    for (size_t pos = 2; pos < layout.sos_offset;) {
+      const unsigned char marker = jpeg[pos + 1];
+      if (marker == 0xFF) {
+        ++pos;
+        continue;
+      }
+      if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {
+        pos += 2;
+        continue;
+      }
+      const size_t length = read_u16_be(&jpeg[pos + 2]);
+      const auto segment = jpeg.subspan(pos + 4, length - 2);
+      if ((marker == 0xDB && !read_quant_tables(segment)) ||
+          (marker == 0xC4 && !read_huffman_tables(segment)) ||
+          ((marker == 0xC0 || marker == 0xC1) && !read_components(segment)))
+        return false;
+      pos += 2 + length;
+    }
+    const size_t length = read_u16_be(&jpeg[layout.sos_offset + 2]);
+    return read_scan(jpeg.subspan(layout.sos_offset + 4, length - 2));
+  }
+
+  void allocate_planes() {
+    const size_t mcu_rows =
+        (layout.height + layout.mcu_height - 1) / layout.mcu_height;
+    arena.reset();
+    for (size_t i = 0; i < component_count; ++i) {
+      pitches[i] = bands.mcus_per_row() * components[i].h * 8;
+      planes[i] = arena.allocate<unsigned char>(pitches[i] * mcu_rows *
+                                                components[i].v * 8);
+    }
+
+    direct_chroma = component_count == 3;
+    for (size_t i = 1; i < component_count; ++i)
+      direct_chroma = direct_chroma && components[i].h * 2 == max_h &&
+                      components[i].v * 2 == max_v;
+    chroma_pitch = (layout.width + 1) / 2;
+    if (!direct_chroma)
+      for (auto &plane : chroma)
+        plane = arena.allocate<unsigned char>(chroma_pitch *
+                                              ((layout.height + 1) / 2));
+
+    if (chroma_filter == ChromaFilter::Linear && component_count == 3) {
+      for (size_t i = 0; i < 2; ++i) {
+        const size_t h = components[i + 1].h;
+        const size_t samples = (layout.width * h + max_h - 1) / max_h;
+        chroma_columns[i] = arena.allocate<uint32_t>(layout.width);
+        for (size_t x = 0; x < layout.width; ++x)
+          chroma_columns[i][x] = chroma_position(x, h, max_h, samples);
+      }
+    }
+  }
+
+  // Position of the chroma sample under pixel i in 1/256 of a sample, with
+  // samples centred on the pixels they cover. Clamped to the image, so that
+  // the edges repeat their outermost sample.
+  static uint32_t chroma_position(size_t i, size_t factor, size_t max_factor,
+                                  size_t samples) {
+    const long position =
+        static_cast<long>((2 * i + 1) * factor * 128 / max_factor) - 128;
+    return std::clamp<long>(position, 0, static_cast<long>(samples - 1) * 256);
+  }
+
+  // the two chroma rows around pixel row y, and the weight of the second
+  struct ChromaRows {
+    const unsigned char *first, *second;
+    int weight;
+  };
+  ChromaRows chroma_rows(size_t i, size_t y) const {
+    const size_t v = components[i].v;
+    const size_t samples = (layout.height * v + max_v - 1) / max_v;
+    const uint32_t position = chroma_position(y, v, max_v, samples);
+    const unsigned char *first = planes[i] + (position >> 8) * pitches[i];
+    const int weight = position & 0xFF;
+    return {first, weight ? first + pitches[i] : first, weight};
+  }
+  static int interpolate(const ChromaRows &rows, uint32_t column) {
+    const size_t x = column >> 8;
+    const int weight = column & 0xFF;
+    const size_t next = weight ? x + 1 : x;
+    const int first =
+        rows.first[x] * (256 - weight) + rows.first[next] * weight;
+    const int second =
+        rows.second[x] * (256 - weight) + rows.second[next] * weight;
+    return (first * (256 - rows.weight) + second * rows.weight + (1 << 15)) >>
+           16;
+  }
+
+  static int decode_symbol(BitReader &reader, const HuffmanTable &table) {
+    const uint16_t entry = table.fast[reader.peek(HuffmanTable::fast_bits)];
+    if (entry) {
+      reader.consume(entry >> 8);
+      return entry & 0xFF;
+    }
+    for (int length = HuffmanTable::fast_bits + 1; length <= 16; ++length) {
+      const int32_t code = reader.peek(length);
+      if (code <= table.max_code[length]) {
+        reader.consume(length);
+        return table.symbols[table.offset[length] + code];
+      }
+    }
+    return -1;
+  }
+
+  static int receive(BitReader &reader, int size) {
+    if (size == 0)
+      return 0;
+    const int value = reader.peek(size);
+    reader.consume(size);
+    return value < (1 << (size - 1)) ? value - (1 << size) + 1 : value;
+  }
+
+  bool decode_block(BitReader &reader, const Component &component, int &dc,
+                    int block[64]) const {
+    std::fill_n(block, 64, 0);
+    const uint16_t *q = quant[component.quant_table];
+
+    reader.refill();
+    const int dc_size = decode_symbol(reader, dc_tables[component.dc_table]);
+    if (dc_size < 0 || dc_size > 11)
+      return false;
+    dc += receive(reader, dc_size);
+    block[0] = std::clamp(dc * q[0], -32768, 32767);
+
+    const auto &ac_table = ac_tables[component.ac_table];
+    for (int k = 1; k < 64;) {
+      reader.refill();
+      const int symbol = decode_symbol(reader, ac_table);
+      if (symbol < 0)
+        return false;
+      const int run = symbol >> 4;
+      const int size = symbol & 0x0F;
+      if (size == 0) {
+        if (run != 15)
+          break; // end of block
+        k += 16;
+        continue;
+      }
+      k += run;
+      if (k > 63)
+        return false;
+      const int z = zigzag[k++];
+      block[z] = std::clamp(receive(reader, size) * q[z], -32768, 32767);
+    }
+    return true;
+  }
+
+  static constexpr int fixed(float x) {
+    return static_cast<int>(x * 4096 + 0.5f);
+  }
+
+  // One dimensional pass of the integer IDCT of the IJG library, the outputs
+  // are scaled up by 4096.
+  static void idct_1d(const int s[8], int out[8]) {
+    const int p1 = (s[2] + s[6]) * fixed(0.5411961f);
+    const int t2 = p1 + s[6] * fixed(-1.847759065f);
+    const int t3 = p1 + s[2] * fixed(0.765366865f);
+    const int e0 = (s[0] + s[4]) * 4096;
+    const int e1 = (s[0] - s[4]) * 4096;
+    const int x0 = e0 + t3, x3 = e0 - t3;
+    const int x1 = e1 + t2, x2 = e1 - t2;
+
+    const int q1 = s[7] + s[1], q2 = s[5] + s[3];
+    const int q3 = s[7] + s[3], q4 = s[5] + s[1];
+    const int p5 = (q3 + q4) * fixed(1.175875602f);
+    const int r1 = p5 + q1 * fixed(-0.899976223f);
+    const int r2 = p5 + q2 * fixed(-2.562915447f);
+    const int r3 = q3 * fixed(-1.961570560f);
+    const int r4 = q4 * fixed(-0.390180644f);
+    const int o0 = s[7] * fixed(0.298631336f) + r1 + r3;
+    const int o1 = s[5] * fixed(2.053119869f) + r2 + r4;
+    const int o2 = s[3] * fixed(3.072711026f) + r2 + r3;
+    const int o3 = s[1] * fixed(1.501321110f) + r1 + r4;
+
+    out[0] = x0 + o3;
+    out[7] = x0 - o3;
+    out[1] = x1 + o2;
+    out[6] = x1 - o2;
+    out[2] = x2 + o1;
+    out[5] = x2 - o1;
+    out[3] = x3 + o0;
+    out[4] = x3 - o0;
+  }
+
+  static void idct(const int block[64], unsigned char *out, size_t pitch) {
+    int columns[64];
+    for (int x = 0; x < 8; ++x) {
+      int s[8], o[8];
+      bool only_dc = true;
+      for (int y = 0; y < 8; ++y) {
+        s[y] = block[8 * y + x];
+        only_dc = only_dc && (y == 0 || s[y] == 0);
+      }
+      if (only_dc) {
+        for (int y = 0; y < 8; ++y)
+          columns[8 * y + x] = s[0] * 4;
+        continue;
+      }
+      idct_1d(s, o);
+      // keep two extra bits of precision for the second pass
+      for (int y = 0; y < 8; ++y)
+        columns[8 * y + x] = (o[y] + 512) >> 10;
+    }
+    for (int y = 0; y < 8; ++y, out += pitch) {
+      int o[8];
+      idct_1d(columns + 8 * y, o);
+      // remove the remaining scale and shift back to the 0..255 range
+      for (int x = 0; x < 8; ++x)
+        out[x] = std::clamp((o[x] + (1 << 16) + (128 << 17)) >> 17, 0, 255);
+    }
+  }
+
+  bool decode_band(const RestartBands::Band &band) {
+    const size_t interval = bands.interval();
+    const size_t mcus_per_row = bands.mcus_per_row();
+    const size_t first_mcu = band.first_mcu_row * mcus_per_row;
+    const size_t end_mcu = band.end_mcu_row * mcus_per_row;
+    const unsigned char *const data_end = jpeg.data() + band.data_end;
+
+    BitReader reader{jpeg.data() + band.data_begin, data_end};
+    int dc[max_components] = {};
+    int block[64];
+    for (size_t mcu = first_mcu; mcu < end_mcu; ++mcu) {
+      if (mcu != first_mcu && mcu % interval == 0) {
+        reader.restart(jpeg.data() + bands.marker(mcu / interval - 1) + 2,
+                       data_end);
+        std::fill_n(dc, max_components, 0);
+      }
+      const size_t mcu_x = mcu % mcus_per_row;
+      const size_t mcu_y = mcu / mcus_per_row;
+      for (size_t i = 0; i < component_count; ++i) {
+        const auto &component = components[i];
+        for (size_t v = 0; v < component.v; ++v) {
+          for (size_t h = 0; h < component.h; ++h) {
+            if (!decode_block(reader, component, dc[i], block))
+              return false;
+            const size_t x = (mcu_x * component.h + h) * 8;
+            const size_t y = (mcu_y * component.v + v) * 8;
+            idct(block, planes[i] + y * pitches[i] + x, pitches[i]);
+          }
+        }
+      }
+    }
+    return true;
+  }
+
+  // Point samples the chroma rows of the band down (or up) to 4:2:0.
+  void resample_chroma(const RestartBands::Band &band) {
+    const size_t first_row = band.first_row / 2;
+    const size_t end_row = (band.first_row + band.row_count + 1) / 2;
+    for (size_t i = 0; i < 2; ++i) {
+      unsigned char *const out = chroma[i];
+      if (component_count == 1) {
+        std::fill(out + first_row * chroma_pitch, out + end_row * chroma_pitch,
+                  128);
+        continue;
+      }
+      const auto &component = components[i + 1];
+      for (size_t y = first_row; y < end_row; ++y) {
+        const unsigned char *row =
+            planes[i + 1] + 2 * y * component.v / max_v * pitches[i + 1];
+        for (size_t x = 0; x < chroma_pitch; ++x)
+          out[y * chroma_pitch + x] = row[2 * x * component.h / max_h];
+      }
+    }
+  }
+
+  // full range YCbCr to RGBA
+  static void store_pixel(unsigned char *out, int y, int cb, int cr) {
+    constexpr int fix = 1 << 16;
+    constexpr int cr_r = static_cast<int>(1.402 * fix + 0.5);
+    constexpr int cb_g = static_cast<int>(0.344136 * fix + 0.5);
+    constexpr int cr_g = static_cast<int>(0.714136 * fix + 0.5);
+    constexpr int cb_b = static_cast<int>(1.772 * fix + 0.5);
+    const int l = y * fix + fix / 2;
+    const int b = cb - 128;
+    const int r = cr - 128;
+    out[0] = std::clamp((l + cr_r * r) >> 16, 0, 255);
+    out[1] = std::clamp((l - cb_g * b - cr_g * r) >> 16, 0, 255);
+    out[2] = std::clamp((l + cb_b * b) >> 16, 0, 255);
+    out[3] = 255;
+  }
+
+  // Writes the rows of the band as RGBA. Linear filtering reads the chroma
+  // rows next to the band, so their bands have to be decoded already.
+  void convert_band(const RestartBands::Band &band, unsigned char *pixels,
+                    size_t pitch) const {
+    const size_t end_row = band.first_row + band.row_count;
+    for (size_t y = band.first_row; y < end_row; ++y) {
+      unsigned char *out = pixels + y * pitch;
+      const unsigned char *luma = planes[0] + y * pitches[0];
+      if (component_count == 1) {
+        for (size_t x = 0; x < layout.width; ++x, out += 4)
+          store_pixel(out, luma[x], 128, 128);
+        continue;
+      }
+      if (chroma_filter == ChromaFilter::Linear) {
+        const auto cb = chroma_rows(1, y);
+        const auto cr = chroma_rows(2, y);
+        for (size_t x = 0; x < layout.width; ++x, out += 4)
+          store_pixel(out, luma[x], interpolate(cb, chroma_columns[0][x]),
+                      interpolate(cr, chroma_columns[1][x]));
+        continue;
+      }
+      const unsigned char *cb =
+          planes[1] + y * components[1].v / max_v * pitches[1];
+      const unsigned char *cr =
+          planes[2] + y * components[2].v / max_v * pitches[2];
+      // steps through the chroma samples at h / max_h the luma rate
+      size_t cb_phase = 0, cr_phase = 0;
+      for (size_t x = 0; x < layout.width; ++x, out += 4) {
+        store_pixel(out, luma[x], *cb, *cr);
+        if ((cb_phase += components[1].h) >= max_h) {
+          cb_phase -= max_h;
+          ++cb;
+        }
+        if ((cr_phase += components[2].h) >= max_h) {
+          cr_phase -= max_h;
+          ++cr;
+        }
+      }
+    }
+  }
+
+public:
+  JpegDecoder(WorkerPool &pool,
+              ChromaFilter chroma_filter = ChromaFilter::Linear)
+      : pool{pool}, chroma_filter{chroma_filter} {}
+
+  // Checks that frame is a baseline JPEG of at most max_width x max_height
+  // and sets it up for decoding, frame has to stay alive until decode
+  // returns.
+  bool prepare(std::span<const unsigned char> frame, size_t max_width,
+               size_t max_height) {
+    const auto parsed = parse_jpeg_layout(frame);
+    if (!parsed || !parsed->baseline || parsed->width > max_width ||
+        parsed->height > max_height)
+      return false;
+    jpeg = frame;
+    layout = *parsed;
+    if (!read_headers() || !bands.plan(jpeg, layout, pool.concurrency()))
+      return false;
+    allocate_planes();
+    return true;
+  }
+
+  // Decodes the prepared frame into the planes returned by y, cb and cr.
+  bool decode() {
+    std::atomic<bool> success{true};
+    pool.parallel_for(bands.bands().size(), [&](size_t i) {
+      const auto &band = bands.bands()[i];
+      if (!decode_band(band)) {
+        success = false;
+        return;
+      }
+      if (!direct_chroma)
+        resample_chroma(band);
+    });
+    return success;
+  }
+
+  // Decodes the prepared frame for write_rgba, which can't fail anymore.
+  bool decode_blocks() {
+    std::atomic<bool> success{true};
+    pool.parallel_for(bands.bands().size(), [&](size_t i) {
+      if (!decode_band(bands.bands()[i]))
+        success = false;
+    });
+    return success;
+  }
+  // Writes the rows of the frame decode_blocks decoded as RGBA pixels, pitch
+  // bytes apart.
+  void write_rgba(unsigned char *pixels, size_t pitch) const {
+    pool.parallel_for(bands.bands().size(), [&](size_t i) {
+      convert_band(bands.bands()[i], pixels, pitch);
+    });
+  }
+  // both of the above
+  bool decode(unsigned char *pixels, size_t pitch) {
+    if (!decode_blocks())
+      return false;
+    write_rgba(pixels, pitch);
+    return true;
+  }
+
+  // size of the prepared frame
+  size_t width() const { return layout.width; }
+  size_t height() const { return layout.height; }
+
+  Plane y() const { return {planes[0], pitches[0]}; }
+  Plane cb() const {
+    return direct_chroma ? Plane{planes[1], pitches[1]}
+                         : Plane{chroma[0], chroma_pitch};
+  }
+  Plane cr() const {
+    return direct_chroma ? Plane{planes[2], pitches[2]}
+                         : Plane{chroma[1], chroma_pitch};
+  }
+};
+
+#endif
@@ -0,0 +1,209 @@
+#ifndef MOTOR_LINK_H
+#define MOTOR_LINK_H
+
+#include <algorithm>
+#include <asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+#include "datagram_transmitter.h"
+#include "motor_data.h"
+#include "motor_packet.h"
+#include "motor_stats.h"
+#include "session_recorder.h"
+#include "transmitter.h"
+#include "tripplebuffer.h"
+
+// Sends motor commands over the transmitter as soon as the input changes,
+// but no more often than every min_interval, and repeats the current command
+// every heartbeat interval while it doesn't change. Acknowledgements from the
+// vehicle are read back to measure the round trip time. Over UDP every
+// datagram repeats the previous commands as well, over TCP a lost segment
+// holds up every command after it until it is retransmitted. All of the
+// state below is touched on the strand only, the GUI thread just posts to it.
+class MotorLink {
+public:
+  enum class Channel { Tcp, Udp };
+
+private:
+  using clock = std::chrono::steady_clock;
+  static constexpr auto stale_after = std::chrono::milliseconds{250};
+
+  Transmitter &transmitter;
+  DatagramTransmitter &datagram_transmitter;
+  const Channel channel;
+  SessionRecorder &recorder;
+  asio::strand<asio::io_context::executor_type> strand;
+  asio::steady_timer timer;
+  const clock::duration min_interval;
+  const clock::duration heartbeat;
+
+  MotorData current{};
+  bool dirty{false};   // current hasn't been sent yet
+  bool started{false}; // once the first connection was made
+  uint32_t sequence{0};
+  uint32_t acked_sequence{0}; // the newest acknowledged
+  clock::time_point last_send{};
+  MotorDatagram datagram{};
+  MotorAck ack{}; // written by the transmitter while receiving
+  uint64_t dropped_before{0}; // by the transmitter, before this connection
+
+  struct Snapshot {
+    MotorStats stats;
+    bool fresh;
+  };
+  TrippleBuffer<Snapshot>::Storage storage{};
+  TrippleBuffer<Snapshot> snapshots{storage};
+  MotorStats stats{};
+
+  // GUI thread only
+  std::optional<MotorData> submitted;
+
+  static int64_t to_us(clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               time.time_since_epoch())
+        .count();
+  }
+
+  void publish() {
+    snapshots.get_back_buffer() = {stats, true};
+    snapshots.swap_back();
+  }
+
+  // waits for the next command to be due, a pending wait is cancelled
+  void schedule() {
+    const auto deadline = last_send + (dirty ? min_interval : heartbeat);
+    if (deadline <= clock::now()) {
+      send();
+      return;
+    }
+    timer.expires_at(deadline);
+    timer.async_wait(asio::bind_executor(strand, [this](asio::error_code ec) {
+      if (!ec)
+        send();
+    }));
+  }
+
+  // The transmitter discards commands while it isn't connected.
+  void send() {
+    if (!started)
+      return;
+    const auto now = clock::now();
+    const MotorCommand command{++sequence, 0, to_us(now),
+                               static_cast<float>(current.left_speed),
+                               static_cast<float>(current.right_speed)};
+    ++stats.commands_sent;
+    stats.heartbeats_sent += !dirty;
+    stats.unacked = command.sequence - acked_sequence;
+    dirty = false;
+    last_send = now;
+    recorder.record_motor_command(command);
+    if (channel == Channel::Udp) {
+      std::copy_backward(datagram.commands,
+                         datagram.commands + MOTOR_REDUNDANCY - 1,
+                         datagram.commands + MOTOR_REDUNDANCY);
+      datagram.commands[0] = command;
+      datagram.count =
+          std::min<uint32_t>(datagram.count + 1, MOTOR_REDUNDANCY);
+      datagram_transmitter.send(datagram);
+    } else {
+      transmitter.send(command);
+    }
+    schedule();
+  }
+
+  void receive_ack() {
+    auto handler = asio::bind_executor(
+        strand, [this](asio::error_code ec, std::size_t bytes_received) {
+          // an unreachable port is reported on the next receive over UDP
+          if (ec && ec != asio::error::connection_refused)
+            return;
+          if (!ec && bytes_received == sizeof(ack))
+            on_ack();
+          receive_ack();
+        });
+    if (channel == Channel::Udp)
+      datagram_transmitter.async_receive(ack, std::move(handler));
+    else
+      transmitter.async_receive(ack, std::move(handler));
+  }
+
+  void on_ack() {
+    const auto rtt = std::chrono::duration_cast<clock::duration>(
+        std::chrono::microseconds{to_us(clock::now()) - ack.send_time_us});
+    stats.rtt = rtt;
+    // smoothed like the SRTT of RFC 6298
+    if (stats.commands_acked)
+      stats.smoothed_rtt += (rtt - stats.smoothed_rtt) / 8;
+    else
+      stats.smoothed_rtt = rtt;
+    stats.max_rtt = std::max(stats.max_rtt, rtt);
+    ++stats.commands_acked;
+    stats.commands_stale += !ack.applied || rtt > stale_after;
+    // acknowledgements can come in out of order over UDP
+    if (static_cast<int32_t>(ack.sequence - acked_sequence) > 0)
+      acked_sequence = ack.sequence;
+    stats.unacked = sequence - acked_sequence;
+    stats.commands_dropped = dropped() - dropped_before;
+    stats.commands_lost = ack.lost;
+    publish();
+  }
+
+  uint64_t dropped() const {
+    return channel == Channel::Udp ? datagram_transmitter.dropped()
+                                   : transmitter.dropped();
+  }
+
+public:
+  MotorLink(asio::io_context &ctx, Transmitter &transmitter,
+            DatagramTransmitter &datagram_transmitter, Channel channel,
+            SessionRecorder &recorder, clock::duration min_interval,
+            clock::duration heartbeat)
+      : transmitter{transmitter}, datagram_transmitter{datagram_transmitter},
+        channel{channel}, recorder{recorder},
+        strand{asio::make_strand(ctx)}, timer{strand},
+        min_interval{min_interval}, heartbeat{heartbeat} {}
+
+  // Called from the GUI thread with the current input, which is sent if it
+  // changed.
+  void set(const MotorData &data) {
+    if (submitted && submitted->left_speed == data.left_speed &&
+        submitted->right_speed == data.right_speed)
+      return;
+    submitted = data;
+    asio::post(strand, [this, data] {
+      current = data;
+      dirty = true;
+      schedule();
+    });
+  }
+
+  // called once the transmitter has connected
+  void on_connected() {
+    asio::post(strand, [this] {
+      started = true;
+      acked_sequence = sequence;
+      datagram.count = 0;
+      dropped_before = dropped();
+      stats = {};
+      publish();
+      receive_ack();
+      dirty = true;
+      last_send = {};
+      schedule();
+    });
+  }
+
+  // Returns the latest statistics if they haven't been taken yet.
+  std::optional<MotorStats> take_stats() {
+    snapshots.swap_front();
+    auto &snapshot = snapshots.get_front_buffer();
+    if (!snapshot.fresh)
+      return std::nullopt;
+    snapshot.fresh = false;
+    return snapshot.stats;
+  }
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef MOTOR_STATS_H
+#define MOTOR_STATS_H
+
+#include <chrono>
+#include <cstdint>
+
+struct MotorStats {
+  std::chrono::steady_clock::duration rtt;          // of the latest command
+  std::chrono::steady_clock::duration smoothed_rtt; // like TCP's SRTT
+  std::chrono::steady_clock::duration max_rtt;
+  // totals since the connection was made
+  uint64_t commands_sent;
+  uint64_t heartbeats_sent; // commands sent without the input changing
+  uint64_t commands_acked;
+  // acknowledged after stale_after, or not applied by the vehicle because a
+  // newer command had arrived first
+  uint64_t commands_stale;
+  uint64_t commands_dropped; // while the connection stalled
+  uint64_t commands_lost;    // never received by the vehicle
+  uint32_t unacked; // commands sent after the latest acknowledged one
+};
+
+#endif
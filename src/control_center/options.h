@@ -0,0 +1,115 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "gui_context.h"
+#include "jpeg_decoder.h"
+#include "motor_link.h"
+#include "playout_buffer.h"
+#include "video_packet.h"
+
+struct Options {
+  PixelFormat video_format = PixelFormat::RGBA;
+  PlayoutBuffer::Mode playout_mode = PlayoutBuffer::Mode::ZeroDepth;
+  // point sampling the chroma of RGBA video is cheaper, but blockier
+  JpegDecoder::ChromaFilter chroma_filter = JpegDecoder::ChromaFilter::Linear;
+  // cameras, stream i is received on video_port(i)
+  int video_streams = 1;
+  // vehicles supervised at once, and the memory each of them may take
+  int vehicles = 1;
+  size_t vehicle_memory = 64 << 20;
+  // datagrams drained per wakeup of a receiving loop, 1 disables batching
+  size_t receive_batch = 32;
+  // where the session is recorded to, nothing is recorded if not set
+  std::optional<std::filesystem::path> record_directory;
+  // TCP is the fallback for networks that block the datagrams
+  MotorLink::Channel motor_channel = MotorLink::Channel::Udp;
+  // motor commands are sent at most this often when the input changes
+  double motor_rate = 50; // per second
+  // and repeated this long after the last one when it doesn't
+  std::chrono::milliseconds motor_heartbeat{100};
+  // CPUs the threads of the subsystems are pinned to, if set
+  std::optional<int> video_cpu, telemetry_cpu, control_cpu;
+  // SCHED_FIFO priority of the control thread, if set
+  std::optional<int> control_priority;
+};
+
+inline Options parse_options(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (arg == "--video-mode" && i + 1 < argc) {
+      const std::string_view mode = argv[++i];
+      if (mode == "rgba")
+        options.video_format = PixelFormat::RGBA;
+      else if (mode == "yuv")
+        options.video_format = PixelFormat::YUV;
+      else
+        throw std::runtime_error("Unknown video mode " + std::string(mode));
+    } else if (arg == "--playout" && i + 1 < argc) {
+      const std::string_view mode = argv[++i];
+      if (mode == "zero")
+        options.playout_mode = PlayoutBuffer::Mode::ZeroDepth;
+      else if (mode == "adaptive")
+        options.playout_mode = PlayoutBuffer::Mode::Adaptive;
+      else
+        throw std::runtime_error("Unknown playout mode " + std::string(mode));
+    } else if (arg == "--chroma-filter" && i + 1 < argc) {
+      const std::string_view filter = argv[++i];
+      if (filter == "linear")
+        options.chroma_filter = JpegDecoder::ChromaFilter::Linear;
+      else if (filter == "nearest")
+        options.chroma_filter = JpegDecoder::ChromaFilter::Nearest;
+      else
+        throw std::runtime_error("Unknown chroma filter " +
+                                 std::string(filter));
+    } else if (arg == "--streams" && i + 1 < argc) {
+      options.video_streams =
+          std::clamp(std::stoi(argv[++i]), 1, MAX_VIDEO_STREAMS);
+    } else if (arg == "--vehicles" && i + 1 < argc) {
+      options.vehicles = std::clamp(std::stoi(argv[++i]), 1, 16);
+    } else if (arg == "--vehicle-memory" && i + 1 < argc) {
+      options.vehicle_memory = std::stoul(argv[++i]) << 20; // in MiB
+    } else if (arg == "--receive-batch" && i + 1 < argc) {
+      options.receive_batch = std::max<size_t>(std::stoul(argv[++i]), 1);
+    } else if (arg == "--record" && i + 1 < argc) {
+      options.record_directory = argv[++i];
+    } else if (arg == "--motor-channel" && i + 1 < argc) {
+      const std::string_view channel = argv[++i];
+      if (channel == "udp")
+        options.motor_channel = MotorLink::Channel::Udp;
+      else if (channel == "tcp")
+        options.motor_channel = MotorLink::Channel::Tcp;
+      else
+        throw std::runtime_error("Unknown motor channel " +
+                                 std::string(channel));
+    } else if (arg == "--motor-rate" && i + 1 < argc) {
+      options.motor_rate = std::stod(argv[++i]);
+      if (options.motor_rate <= 0)
+        throw std::runtime_error("The motor rate has to be positive");
+    } else if (arg == "--motor-heartbeat" && i + 1 < argc) {
+      options.motor_heartbeat = std::chrono::milliseconds{
+          std::max(std::stol(argv[++i]), 1L)};
+    } else if (arg == "--video-cpu" && i + 1 < argc) {
+      options.video_cpu = std::stoi(argv[++i]);
+    } else if (arg == "--telemetry-cpu" && i + 1 < argc) {
+      options.telemetry_cpu = std::stoi(argv[++i]);
+    } else if (arg == "--control-cpu" && i + 1 < argc) {
+      options.control_cpu = std::stoi(argv[++i]);
+    } else if (arg == "--control-priority" && i + 1 < argc) {
+      options.control_priority = std::clamp(std::stoi(argv[++i]), 1, 99);
+    } else {
+      throw std::runtime_error("Unknown option " + std::string(arg));
+    }
+  }
+  return options;
+}
+
+#endif
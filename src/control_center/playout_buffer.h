@@ -0,0 +1,194 @@
+#ifndef PLAYOUT_BUFFER_H
+#define PLAYOUT_BUFFER_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+#include "compressed_image.h"
+
+// Holds completed frames back until their playout time, so that frames that
+// arrive in bursts get shown at the pace they were captured at. The playout
+// time is the capture time mapped onto the local clock through the fastest
+// transit seen so far, plus a delay that follows the measured jitter: it
+// jumps up to cover late frames and slowly decays to keep latency low. With
+// a zero depth every frame is due as soon as it arrives.
+//
+// Frames are handed over under a mutex. What the GUI thread asks for on
+// every iteration of its loop, and the statistics, are published through
+// atomics instead, so that it doesn't contend for the mutex with the
+// receiving thread.
+class PlayoutBuffer {
+public:
+  enum class Mode {
+    ZeroDepth, // lowest latency, for driving
+    Adaptive,
+  };
+  static constexpr size_t capacity = 8; // frames
+
+private:
+  using clock = std::chrono::steady_clock;
+  static constexpr clock::duration max_delay = std::chrono::milliseconds{250};
+
+  struct Entry {
+    CompressedImage image;
+    uint32_t frame_id;
+    clock::time_point playout_time;
+    bool queued;
+  };
+
+  std::mutex mutex;
+  std::array<Entry, capacity> entries;
+  const Mode mode;
+
+  // receiving thread only
+  bool has_transit{false};
+  clock::duration base_transit{}; // includes the offset between the clocks
+  clock::duration delay{};
+
+  // written under the mutex, read without it
+  std::atomic<clock::rep> earliest_playout{
+      clock::time_point::max().time_since_epoch().count()};
+  std::atomic<size_t> queued{0};
+  std::atomic<clock::rep> published_delay{0};
+  std::atomic<uint64_t> skipped{0};
+
+  static bool is_newer(uint32_t a, uint32_t b) {
+    return static_cast<int32_t>(a - b) > 0;
+  }
+
+  // after the entries changed, with the mutex held
+  void publish_entries() {
+    auto earliest = clock::time_point::max();
+    size_t count = 0;
+    for (const auto &entry : entries) {
+      if (!entry.queued)
+        continue;
+      earliest = std::min(earliest, entry.playout_time);
+      ++count;
+    }
+    earliest_playout.store(earliest.time_since_epoch().count(),
+                           std::memory_order_relaxed);
+    queued.store(count, std::memory_order_relaxed);
+  }
+
+  clock::time_point playout_time(clock::time_point now,
+                                 uint64_t capture_time_us) {
+    if (mode == Mode::ZeroDepth)
+      return now;
+    const auto transit = now.time_since_epoch() -
+                         std::chrono::microseconds{capture_time_us};
+    // Creeps up slowly, so that drift between the clocks doesn't leave the
+    // base stuck at a transit that can't be reached anymore.
+    if (!has_transit || transit < base_transit)
+      base_transit = transit;
+    else
+      base_transit += (transit - base_transit) / 4096;
+    has_transit = true;
+
+    const auto lateness = transit - base_transit;
+    if (lateness > delay)
+      delay = std::min(lateness, max_delay);
+    else
+      delay -= (delay - lateness) / 128;
+    return now - lateness + delay;
+  }
+
+public:
+  PlayoutBuffer(Mode mode, size_t frame_capacity) : mode{mode} {
+    for (auto &entry : entries) {
+      entry.image = {std::make_unique<unsigned char[]>(frame_capacity), 0};
+      entry.queued = false;
+    }
+  }
+
+  // Queues a completed frame by swapping buffers with a free entry, frame
+  // must have been allocated with the capacity given to the constructor.
+  // Frames have to be submitted in order.
+  void submit(CompressedImage &frame, uint32_t frame_id,
+              uint64_t capture_time_us) {
+    const auto time = playout_time(clock::now(), capture_time_us);
+
+    published_delay.store(delay.count(), std::memory_order_relaxed);
+    std::lock_guard lock{mutex};
+    Entry *free = nullptr;
+    for (auto &entry : entries) {
+      if (!entry.queued) {
+        free = &entry;
+        break;
+      }
+      if (!free || is_newer(free->frame_id, entry.frame_id))
+        free = &entry;
+    }
+    if (free->queued) // the buffer is full, the oldest frame goes
+      skipped.fetch_add(1, std::memory_order_relaxed);
+    std::swap(free->image, frame);
+    free->frame_id = frame_id;
+    free->playout_time = time;
+    free->queued = true;
+    publish_entries();
+  }
+
+  // Swaps the newest frame that is due into frame, frames before it are
+  // skipped. Returns the id of the frame, or nothing if no frame is due.
+  std::optional<uint32_t> take(CompressedImage &frame) {
+    const auto now = clock::now();
+    if (next_playout_time() > now)
+      return std::nullopt; // without taking the mutex
+    std::lock_guard lock{mutex};
+    Entry *due = nullptr;
+    for (auto &entry : entries)
+      if (entry.queued && entry.playout_time <= now &&
+          (!due || is_newer(entry.frame_id, due->frame_id)))
+        due = &entry;
+    if (!due)
+      return std::nullopt;
+
+    for (auto &entry : entries) {
+      if (entry.queued && is_newer(due->frame_id, entry.frame_id)) {
+        entry.queued = false;
+        skipped.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    std::swap(due->image, frame);
+    due->queued = false;
+    publish_entries();
+    return due->frame_id;
+  }
+
+  // Drops the queued frames and the transit measured so far, from the
+  // receiving thread when the sender started over.
+  void reset() {
+    has_transit = false;
+    delay = {};
+    published_delay.store(0, std::memory_order_relaxed);
+    std::lock_guard lock{mutex};
+    for (auto &entry : entries)
+      entry.queued = false;
+    publish_entries();
+  }
+
+  // when the next queued frame is due, max() if none is queued
+  clock::time_point next_playout_time() const {
+    return clock::time_point{clock::duration{
+        earliest_playout.load(std::memory_order_relaxed)}};
+  }
+  // delay frames are held back by
+  clock::duration playout_delay() const {
+    return clock::duration{published_delay.load(std::memory_order_relaxed)};
+  }
+  size_t queued_frames() const {
+    return queued.load(std::memory_order_relaxed);
+  }
+  // frames that were never shown because a newer one was due
+  uint64_t skipped_frames() const {
+    return skipped.load(std::memory_order_relaxed);
+  }
+};
+
+#endif
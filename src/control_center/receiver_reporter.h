@@ -0,0 +1,81 @@
+#ifndef RECEIVER_REPORTER_H
+#define RECEIVER_REPORTER_H
+
+#include <asio.hpp>
+#include <chrono>
+#include <mutex>
+#include <optional>
+
+#include "address.h"
+#include "frame_stats.h"
+#include "receiver_report.h"
+
+// Sends receiver reports about a video stream back to the host it comes
+// from, so that the sender can adapt its bitrate.
+class ReceiverReporter {
+private:
+  using udp = asio::ip::udp;
+  using clock = std::chrono::steady_clock;
+  udp::socket socket;
+  const udp protocol;
+  const uint16_t port;
+  std::mutex sender_mutex;
+  std::optional<asio::ip::address> sender; // guarded, set once video arrives
+  ReceiverReport report{};
+  FrameStats last{};
+  clock::time_point last_time{clock::now()};
+
+public:
+  ReceiverReporter(asio::io_context &ctx, int stream)
+      : socket{ctx}, protocol{open_dual_stack(socket)},
+        port{report_port(stream)} {
+    socket.non_blocking(true);
+  }
+
+  // called whenever the stream comes from another host
+  void set_sender(const asio::ip::address &address) {
+    std::lock_guard lock{sender_mutex};
+    sender = address;
+  }
+
+  // Reports the change since the previous snapshot.
+  void send(const FrameStats &stats, size_t queue_depth) {
+    using ms = std::chrono::duration<float, std::milli>;
+    const auto now = clock::now();
+    ++report.sequence;
+    report.interval_us = static_cast<uint32_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(now - last_time)
+            .count());
+    report.frames_received =
+        static_cast<uint32_t>(stats.frames_received - last.frames_received);
+    report.frames_lost =
+        static_cast<uint32_t>(stats.frames_lost - last.frames_lost);
+    report.bytes_per_second = static_cast<uint32_t>(stats.bytes_per_second);
+    report.queue_depth = static_cast<uint32_t>(queue_depth);
+    const float frametime = ms{stats.frametime}.count();
+    report.fps = frametime > 0 ? 1000.0f / frametime : 0;
+    report.jitter_ms = ms{stats.jitter}.count();
+    report.decode_ms = ms{stats.decode_time}.count();
+    report.playout_delay_ms = ms{stats.playout_delay}.count();
+    last = stats;
+    last_time = now;
+
+    std::optional<asio::ip::address> address;
+    {
+      std::lock_guard lock{sender_mutex};
+      address = sender;
+    }
+    if (!address)
+      return;
+    // IPv4 hosts are reached through mapped addresses on a dual stack socket
+    if (address->is_v4() && protocol == udp::v6())
+      address = asio::ip::make_address_v6(asio::ip::v4_mapped,
+                                          address->to_v4());
+    // a report that doesn't fit into the socket buffer is simply dropped
+    asio::error_code ec;
+    socket.send_to(asio::buffer(&report, sizeof(report)),
+                   udp::endpoint{*address, port}, 0, ec);
+  }
+};
+
+#endif
@@ -2,29 +2,149 @@
 #define RECEIVING_LOOP_H
 
 #include <asio.hpp>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <vector>
 
-template <typename F1, typename F2> class ReceivingLoop {
+#ifdef __linux__
+#include <sys/socket.h>
+#endif
+
+// Receives datagrams of up to max_datagram_size bytes and hands each of them
+// to on_receive along with its sender. The datagrams stay in buffers owned by
+// the loop, aligned for any type, and are only valid during the call. With a
+// batch_size above one the loop waits for the socket to become readable and
+// then drains up to batch_size datagrams at once, which saves a handler
+// dispatch (and on Linux a syscall) per datagram. Errors are handed to
+// on_receive with an empty datagram, the loop goes on until the socket is
+// closed. Longer datagrams would arrive truncated, they are dropped.
+template <typename F> class ReceivingLoop {
 private:
   using udp = asio::ip::udp;
   udp::socket socket;
   udp::endpoint remote;
-  F1 receive_buffer_generator;
-  F2 on_receive;
+  F on_receive;
+  const size_t max_datagram_size;
+  // one byte more than max_datagram_size, so that longer datagrams show
+  const size_t slot_size;
+  const size_t batch_size;
+  std::vector<unsigned char> slots; // batch_size datagrams
+
+  std::span<const unsigned char> slot(size_t i, size_t bytes_received) const {
+    return {slots.data() + i * slot_size, bytes_received};
+  }
+
+  bool truncated(const asio::error_code &ec, size_t bytes_received) const {
+    return ec == asio::error::message_size ||
+           (!ec && bytes_received > max_datagram_size);
+  }
+
+#ifdef __linux__
+  std::vector<mmsghdr> messages;
+  std::vector<iovec> iovecs;
+  std::vector<sockaddr_storage> addresses;
+
+  void setup_batch() {
+    messages.resize(batch_size);
+    iovecs.resize(batch_size);
+    addresses.resize(batch_size);
+    for (size_t i = 0; i < batch_size; ++i) {
+      iovecs[i] = {slots.data() + i * slot_size, slot_size};
+      messages[i].msg_hdr = {};
+      messages[i].msg_hdr.msg_iov = &iovecs[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+      messages[i].msg_hdr.msg_name = &addresses[i];
+    }
+  }
+
+  void receive_batch() {
+    for (auto &message : messages) {
+      message.msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+      message.msg_hdr.msg_flags = 0;
+    }
+    const int count = ::recvmmsg(socket.native_handle(), messages.data(),
+                                 static_cast<unsigned>(messages.size()),
+                                 MSG_DONTWAIT, nullptr);
+    if (count < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        on_receive(asio::error_code{errno, asio::error::get_system_category()},
+                   slot(0, 0), remote);
+      return;
+    }
+    for (int i = 0; i < count; ++i) {
+      const auto &header = messages[i].msg_hdr;
+      if (header.msg_flags & MSG_TRUNC ||
+          truncated({}, messages[i].msg_len))
+        continue;
+      remote.resize(header.msg_namelen);
+      std::memcpy(remote.data(), header.msg_name, header.msg_namelen);
+      on_receive(asio::error_code{}, slot(i, messages[i].msg_len), remote);
+    }
+  }
+#else
+  void setup_batch() {}
+
+  void receive_batch() {
+    asio::error_code ec;
+    for (size_t i = 0; i < batch_size; ++i) {
+      const size_t bytes_received = socket.receive_from(
+          asio::buffer(slots.data(), slot_size), remote, 0, ec);
+      if (ec == asio::error::would_block)
+        return;
+      if (truncated(ec, bytes_received))
+        continue;
+      on_receive(ec, slot(0, ec ? 0 : bytes_received), remote);
+      if (ec)
+        return;
+    }
+  }
+#endif
+
+  void wait() {
+    socket.async_wait(udp::socket::wait_read, [this](asio::error_code ec) {
+      if (ec) {
+        on_receive(ec, slot(0, 0), remote);
+        if (ec == asio::error::operation_aborted)
+          return; // the socket was closed
+      } else {
+        receive_batch();
+      }
+      wait();
+    });
+  }
 
 public:
-  ReceivingLoop(udp::socket &&socket, F1 &&receive_buffer_generator,
-                F2 &&on_receive)
-      : socket{std::move(socket)}, receive_buffer_generator{std::move(
-                                       receive_buffer_generator)},
-        on_receive{std::move(on_receive)} {
-    (*this)();
+  // A receive_buffer_size of 0 keeps the default size of the socket's
+  // receive buffer.
+  ReceivingLoop(udp::socket &&socket, size_t max_datagram_size,
+                F &&on_receive, size_t batch_size = 1,
+                int receive_buffer_size = 0)
+      : socket{std::move(socket)}, on_receive{std::move(on_receive)},
+        max_datagram_size{max_datagram_size},
+        slot_size{(max_datagram_size + alignof(std::max_align_t)) /
+                  alignof(std::max_align_t) * alignof(std::max_align_t)},
+        batch_size{batch_size}, slots(batch_size * slot_size) {
+    if (receive_buffer_size)
+      this->socket.set_option(
+          asio::socket_base::receive_buffer_size{receive_buffer_size});
+    if (batch_size > 1) {
+      this->socket.non_blocking(true);
+      setup_batch();
+      wait();
+    } else {
+      (*this)();
+    }
   }
   void operator()() {
     socket.async_receive_from(
-        receive_buffer_generator(), remote,
+        asio::buffer(slots.data(), slot_size), remote,
         [this](asio::error_code ec, std::size_t bytes_received) {
-          on_receive(ec, bytes_received, remote);
-          (*this)();
+          if (!truncated(ec, bytes_received))
+            on_receive(ec, slot(0, bytes_received), remote);
+          if (ec != asio::error::operation_aborted)
+            (*this)();
         });
   }
 };
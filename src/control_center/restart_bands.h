@@ -0,0 +1,106 @@
+#ifndef RESTART_BANDS_H
+#define RESTART_BANDS_H
+
+#include <cstring>
+#include <numeric>
+#include <span>
+#include <vector>
+
+#include "jpeg_layout.h"
+
+// Splits the entropy coded data of a JPEG scan into horizontal bands of
+// whole MCU rows that begin at restart markers. Restart markers reset the
+// decoder state, so the bands can be decoded independently.
+class RestartBands {
+public:
+  struct Band {
+    size_t first_interval, end_interval;
+    size_t first_mcu_row, end_mcu_row;
+    size_t first_row, row_count;
+    size_t data_begin, data_end; // entropy coded data of the band
+  };
+
+private:
+  std::vector<size_t> markers; // offsets of the RSTn markers
+  std::vector<Band> _bands;
+  size_t _interval;
+  size_t _mcus_per_row;
+
+  // Returns the offset at which the entropy coded data ends.
+  size_t find_markers(std::span<const unsigned char> jpeg, size_t offset) {
+    markers.clear();
+    const unsigned char *const begin = jpeg.data();
+    const unsigned char *const end = begin + jpeg.size();
+    const unsigned char *p = begin + offset;
+    while (p < end - 1) {
+      p = static_cast<const unsigned char *>(
+          std::memchr(p, 0xFF, end - 1 - p));
+      if (!p)
+        break;
+      if (p[1] >= 0xD0 && p[1] <= 0xD7)
+        markers.push_back(p - begin);
+      else if (p[1] != 0x00 && p[1] != 0xFF)
+        return p - begin;
+      p += p[1] == 0xFF ? 1 : 2;
+    }
+    return jpeg.size();
+  }
+
+public:
+  // Plans at most max_band_count bands, returns false if the restart markers
+  // don't match the layout. Streams that can't be split get a single band.
+  bool plan(std::span<const unsigned char> jpeg, const JpegLayout &layout,
+            size_t max_band_count) {
+    _mcus_per_row = (layout.width + layout.mcu_width - 1) / layout.mcu_width;
+    const size_t mcu_rows =
+        (layout.height + layout.mcu_height - 1) / layout.mcu_height;
+    const size_t mcu_count = _mcus_per_row * mcu_rows;
+    // without restart markers the whole scan is a single interval
+    _interval = layout.restart_interval ? layout.restart_interval : mcu_count;
+    const size_t interval_count = (mcu_count + _interval - 1) / _interval;
+
+    const size_t scan_end = find_markers(jpeg, layout.scan_offset);
+    if (markers.size() + 1 != interval_count)
+      return false;
+
+    // bands can only start where both a restart interval and an MCU row begin
+    const size_t chunk_rows =
+        std::lcm(_interval, _mcus_per_row) / _mcus_per_row;
+    const size_t chunk_count = (mcu_rows + chunk_rows - 1) / chunk_rows;
+    const size_t band_count =
+        std::max<size_t>(std::min(max_band_count, chunk_count), 1);
+
+    _bands.resize(band_count);
+    for (size_t i = 0; i < band_count; ++i) {
+      auto &band = _bands[i];
+      band.first_mcu_row = i * chunk_count / band_count * chunk_rows;
+      band.end_mcu_row =
+          std::min((i + 1) * chunk_count / band_count * chunk_rows, mcu_rows);
+      band.first_interval = band.first_mcu_row * _mcus_per_row / _interval;
+      band.end_interval =
+          std::min((band.end_mcu_row * _mcus_per_row + _interval - 1) /
+                       _interval,
+                   interval_count);
+      band.first_row = band.first_mcu_row * layout.mcu_height;
+      band.row_count =
+          std::min(band.end_mcu_row * layout.mcu_height, layout.height) -
+          band.first_row;
+      band.data_begin = band.first_interval == 0
+                            ? layout.scan_offset
+                            : markers[band.first_interval - 1] + 2;
+      band.data_end = band.end_interval == interval_count
+                          ? scan_end
+                          : markers[band.end_interval - 1];
+    }
+    return true;
+  }
+
+  const std::vector<Band> &bands() const { return _bands; }
+  // restart interval in MCUs
+  size_t interval() const { return _interval; }
+  size_t mcus_per_row() const { return _mcus_per_row; }
+  // offset of the restart marker that ends the given interval
+  size_t marker(size_t interval) const { return markers[interval]; }
+};
+
+#endif
@@ -1,48 +1,113 @@
 #ifndef SENSOR_DATA_H
 #define SENSOR_DATA_H
 
-#include "ringbuffer.h"
-#include <iostream>
-#include <limits>
-
-enum class SensorType {
-  BEGIN = 1,
-  WaterTemperature = BEGIN,
-  WaterTurbidity,
-  Dust,
-  AtmosphericPressure,
-  AtmosphericTemperature,
-  AtmosphericHumidity,
-  BatteryVoltage,
-  END
-};
+#include "sensor_history.h"
+#include "sensor_packet.h"
+#include "tripplebuffer.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <span>
+#include <vector>
 
+// Keeps the history of every sensor on the thread that receives the
+// samples and publishes what the UI shows through a TrippleBuffer, so that
+// neither side ever waits for the other and the UI always sees a consistent
+// state. Which span is shown, at how many points, is set by the UI.
 class SensorData {
 public:
   inline static constexpr size_t sensor_count =
       static_cast<size_t>(SensorType::END) -
       static_cast<size_t>(SensorType::BEGIN);
-  inline static constexpr size_t buffer_size = 120;
+  struct Snapshot {
+    struct Sensor {
+      bool empty{true};
+      float latest;
+      double latest_time;
+      std::vector<SensorHistory::Point> points;
+    };
+    std::array<Sensor, sensor_count> sensors;
+    double span; // of the points, in seconds
+    bool fresh;
+  };
+
+  // at most this many points per sensor, wider plots get fewer than one
+  // per pixel
+  static constexpr size_t max_view_points = 2048;
+
+private:
+  SensorHistory data[sensor_count];
+  std::atomic<double> view_span{60};
+  std::atomic<size_t> view_points{256};
+  TrippleBuffer<Snapshot>::Storage storage{};
+  TrippleBuffer<Snapshot> snapshots{storage};
+
+  void publish() {
+    auto &snapshot = snapshots.get_back_buffer();
+    snapshot.span = view_span.load(std::memory_order_relaxed);
+    const size_t points = view_points.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < sensor_count; ++i) {
+      auto &sensor = snapshot.sensors[i];
+      sensor.empty = data[i].empty();
+      sensor.latest = data[i].latest();
+      sensor.latest_time = data[i].latest_time();
+      data[i].query(snapshot.span, points, sensor.points);
+    }
+    snapshot.fresh = true;
+    snapshots.swap_back();
+  }
+
+public:
+  // The points of every snapshot are allocated up front, so that the memory
+  // taken is known and publishing doesn't allocate.
   SensorData() {
-    std::fill_n(min_vals, sensor_count, 0);
-    std::fill_n(max_vals, sensor_count, 0);
+    for (auto *snapshot :
+         {&storage.buffer0, &storage.buffer1, &storage.buffer2})
+      for (auto &sensor : snapshot->sensors)
+        sensor.points.reserve(max_view_points);
   }
-  void add_reading(SensorType sensor, int64_t /*time*/, float reading) {
-    const auto idx = static_cast<size_t>(sensor) - 1;
-    min_vals[idx] = std::min(min_vals[idx], reading);
-    max_vals[idx] = std::max(max_vals[idx], reading);
-    data[idx].push_back(reading);
+  SensorData(const SensorData &) = delete;
+  SensorData &operator=(const SensorData &) = delete;
+
+  // Receiving thread, skips samples of sensors it doesn't know.
+  void add_samples(std::span<const SensorSample> samples) {
+    for (const auto &sample : samples)
+      if (sample.sensor >= SensorType::BEGIN && sample.sensor < SensorType::END)
+        data[static_cast<size_t>(sample.sensor) - 1].add(
+            static_cast<int64_t>(sample.time_us), sample.value);
+    publish();
   }
-  const Ringbuffer<float, buffer_size> operator[](size_t idx) const noexcept {
-    return data[idx];
+
+  // bytes taken by the histories and the points of the snapshots
+  size_t memory() const {
+    size_t bytes = sizeof(*this) + 3 * sensor_count * max_view_points *
+                                       sizeof(SensorHistory::Point);
+    for (const auto &history : data)
+      bytes += history.memory();
+    return bytes;
   }
-  float min_val(size_t idx) const noexcept {
-    return min_vals[idx];
+
+  // UI thread, takes effect with the next samples.
+  void set_view(double span, size_t points) {
+    view_span.store(span, std::memory_order_relaxed);
+    view_points.store(std::min(points, max_view_points),
+                      std::memory_order_relaxed);
   }
-  float max_val(size_t idx) const noexcept {
-    return max_vals[idx];
+  // UI thread, the snapshot stays valid until the next call.
+  const Snapshot &snapshot() {
+    snapshots.swap_front();
+    if (!snapshots.get_front_buffer().fresh) {
+      // Nothing was published since the last call and the buffer taken
+      // then went back into the middle. Taking it again gets it back, or
+      // one that got published in the meantime.
+      snapshots.swap_front();
+    }
+    auto &snapshot = snapshots.get_front_buffer();
+    snapshot.fresh = false;
+    return snapshot;
   }
-  const char *name(size_t idx) const noexcept {
+
+  static const char *name(size_t idx) noexcept {
     switch (idx) {
     case 0:
       return "Water Temperature";
@@ -61,11 +126,6 @@ public:
     }
     return nullptr;
   }
-
-private:
-  Ringbuffer<float, buffer_size> data[sensor_count];
-  float min_vals[sensor_count];
-  float max_vals[sensor_count];
 };
 
 #endif
\ No newline at end of file
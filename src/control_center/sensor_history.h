@@ -0,0 +1,166 @@
+#ifndef SENSOR_HISTORY_H
+#define SENSOR_HISTORY_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+// Keeps the readings of one sensor at several resolutions: the latest raw
+// samples, and the minimum, maximum and mean of every second, ten seconds
+// and minute further back. Every sample updates the open bucket of each
+// level, so inserting costs the same no matter how much is kept, and a plot
+// reads a level with about as many points as it has pixels, which keeps
+// drawing hours of history as cheap as drawing seconds.
+class SensorHistory {
+public:
+  struct Point {
+    double time; // in seconds, on the sender's clock
+    double min, max, mean;
+  };
+
+private:
+  struct Level {
+    int64_t resolution_us; // 0 for raw samples
+    size_t capacity;
+    std::unique_ptr<Point[]> points;
+    size_t head{0}; // oldest point once full
+    size_t size{0};
+    // open bucket, not in points yet
+    int64_t bucket{0};
+    double sum{0};
+    size_t count{0};
+    Point open{};
+
+    Level(int64_t resolution_us, size_t capacity)
+        : resolution_us{resolution_us}, capacity{capacity},
+          points{std::make_unique<Point[]>(capacity)} {}
+
+    void clear() { head = size = count = 0; }
+    const Point &operator[](size_t i) const {
+      return points[(head + i) % capacity];
+    }
+    void push(const Point &point) {
+      if (size < capacity) {
+        points[(head + size++) % capacity] = point;
+        return;
+      }
+      points[head] = point;
+      head = (head + 1) % capacity;
+    }
+    void add(int64_t time_us, double value) {
+      if (resolution_us == 0) {
+        push({time_us * 1e-6, value, value, value});
+        return;
+      }
+      const int64_t b = time_us / resolution_us;
+      if (count && b != bucket) {
+        push(open);
+        count = 0;
+      }
+      if (!count) {
+        bucket = b;
+        sum = 0;
+        open = {(b * resolution_us + resolution_us / 2) * 1e-6, value, value,
+                value};
+      }
+      sum += value;
+      ++count;
+      open.min = std::min(open.min, value);
+      open.max = std::max(open.max, value);
+      open.mean = sum / count;
+    }
+    // index of the first point at or after time
+    size_t lower_bound(double time) const {
+      size_t first = 0, last = size;
+      while (first < last) {
+        const size_t mid = (first + last) / 2;
+        if ((*this)[mid].time < time)
+          first = mid + 1;
+        else
+          last = mid;
+      }
+      return first;
+    }
+  };
+
+  std::array<Level, 4> levels{{
+      {0, 2048},
+      {1'000'000, 3600},   // an hour
+      {10'000'000, 2880},  // eight hours
+      {60'000'000, 1440}}}; // a day
+  // a sender whose clock goes back further restarted
+  static constexpr int64_t max_reorder_us = 5'000'000;
+
+  int64_t last_time_us{std::numeric_limits<int64_t>::min()};
+  float last_value{0};
+
+public:
+  // Samples that aren't newer than the last one are dropped, they arrived
+  // duplicated or out of order. If they are older by more than a few seconds
+  // the sender's clock was reset, and the history starts over.
+  void add(int64_t time_us, float value) {
+    if (time_us <= last_time_us) {
+      if (last_time_us - time_us <= max_reorder_us)
+        return;
+      for (auto &level : levels)
+        level.clear();
+    }
+    last_time_us = time_us;
+    last_value = value;
+    for (auto &level : levels)
+      level.add(time_us, value);
+  }
+
+  bool empty() const { return levels[0].size == 0; }
+  // bytes taken by the points of all levels
+  size_t memory() const {
+    size_t bytes = 0;
+    for (const auto &level : levels)
+      bytes += level.capacity * sizeof(Point);
+    return bytes;
+  }
+  float latest() const { return last_value; }
+  double latest_time() const { return last_time_us * 1e-6; }
+
+  // Replaces the contents of out with at most max_points points covering
+  // the last span seconds. They come from the finest level that holds the
+  // span, points of a level that has up to four times too many get merged.
+  void query(double span, size_t max_points, std::vector<Point> &out) const {
+    out.clear();
+    if (empty() || max_points == 0)
+      return;
+    const double from = latest_time() - span;
+    for (const auto &level : levels) {
+      const bool covers = level.size < level.capacity ||
+                          (level.size && level[0].time <= from);
+      const size_t first = level.lower_bound(from);
+      const size_t count = level.size - first + (level.count > 0);
+      if (&level != &levels.back() && (!covers || count > 4 * max_points))
+        continue;
+
+      const size_t group = (count + max_points - 1) / max_points;
+      for (size_t i = 0; i < count; i += group) {
+        const size_t end = std::min(i + group, count);
+        Point merged{0, std::numeric_limits<double>::max(),
+                     std::numeric_limits<double>::lowest(), 0};
+        for (size_t j = i; j < end; ++j) {
+          const Point &point =
+              first + j < level.size ? level[first + j] : level.open;
+          merged.time += point.time;
+          merged.min = std::min(merged.min, point.min);
+          merged.max = std::max(merged.max, point.max);
+          merged.mean += point.mean;
+        }
+        merged.time /= end - i;
+        merged.mean /= end - i;
+        out.push_back(merged);
+      }
+      return;
+    }
+  }
+};
+
+#endif
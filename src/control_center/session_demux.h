@@ -0,0 +1,153 @@
+#ifndef SESSION_DEMUX_H
+#define SESSION_DEMUX_H
+
+#include <algorithm>
+#include <asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "address.h"
+#include "receiving_loop.h"
+#include "sensor_packet.h"
+#include "vehicle_session.h"
+#include "video_packet.h"
+
+// Receives the video and sensor datagrams of all vehicles on the ports they
+// share and hands every one to the session of the vehicle that sent it.
+// Video payloads are copied from the receiving loop's buffer straight into
+// their frames, no matter how many sessions there are. With a single
+// session every datagram goes to it, whoever sent it.
+//
+// Otherwise every port keeps track of which session each sender endpoint,
+// address and port, belongs to. A new sender goes to a session connected
+// from its address, IPv4 or IPv6, that has no sender on the port yet or
+// hasn't heard from it for a while. That way several vehicles behind one
+// NAT are told apart by their ports, and a vehicle that restarts with new
+// ports gets picked up again. Datagrams from hosts that no session is
+// connected from are dropped.
+class SessionDemux {
+private:
+  using udp = asio::ip::udp;
+  using clock = std::chrono::steady_clock;
+  using Sessions = std::vector<std::unique_ptr<VehicleSession>>;
+  // a sender that was quiet this long gives up its session on the port
+  static constexpr clock::duration rebind_after = std::chrono::seconds{1};
+
+  struct Binding {
+    udp::endpoint sender;
+    VehicleSession *session;
+    uint32_t connection; // of the session, the binding ends with it
+    clock::time_point last_seen;
+  };
+  // the senders of one port, used on its receiving thread only
+  using Bindings = std::vector<Binding>;
+
+  struct OnVideo {
+    SessionDemux *demux;
+    size_t stream;
+    void operator()(asio::error_code ec,
+                    std::span<const unsigned char> datagram,
+                    const udp::endpoint &sender) const {
+      demux->on_video(stream, ec, datagram, sender);
+    }
+  };
+  struct OnSensors {
+    SessionDemux *demux;
+    void operator()(asio::error_code ec,
+                    std::span<const unsigned char> datagram,
+                    const udp::endpoint &sender) const {
+      demux->on_sensors(ec, datagram, sender);
+    }
+  };
+
+  Sessions &sessions;
+  std::vector<Bindings> video_bindings; // a port per stream
+  Bindings sensor_bindings;
+  std::vector<std::unique_ptr<ReceivingLoop<OnVideo>>> video_loops;
+  ReceivingLoop<OnSensors> sensor_loop;
+
+  VehicleSession *session_of(Bindings &bindings, const udp::endpoint &sender) {
+    if (sessions.size() == 1)
+      return sessions.front().get();
+    const auto now = clock::now();
+    for (auto &binding : bindings)
+      if (binding.sender == sender &&
+          binding.connection == binding.session->connection_count()) {
+        binding.last_seen = now;
+        return binding.session;
+      }
+
+    for (auto &session : sessions) {
+      if (!session->sends_from(sender.address()))
+        continue;
+      auto bound = std::find_if(bindings.begin(), bindings.end(),
+                                [&](const Binding &binding) {
+                                  return binding.session == session.get();
+                                });
+      const Binding binding{sender, session.get(),
+                            session->connection_count(), now};
+      if (bound == bindings.end()) {
+        bindings.push_back(binding);
+      } else if (bound->connection != binding.connection ||
+                 now - bound->last_seen >= rebind_after) {
+        *bound = binding;
+      } else {
+        continue; // another sender of the same host has it
+      }
+      return session.get();
+    }
+    return nullptr;
+  }
+
+  static udp::socket bind_socket(asio::io_context &ctx, uint16_t port) {
+    udp::socket socket{ctx};
+    const auto protocol = open_dual_stack(socket);
+    socket.bind({protocol, port});
+    return socket;
+  }
+
+  void on_video(size_t stream, asio::error_code ec,
+                std::span<const unsigned char> datagram,
+                const udp::endpoint &sender) {
+    if (ec) {
+      std::cerr << "Receiving video failed: " << ec.message() << "\n";
+      return;
+    }
+    if (auto session = session_of(video_bindings[stream], sender))
+      session->video_stream(stream).on_datagram(datagram, sender);
+  }
+
+  void on_sensors(asio::error_code ec, std::span<const unsigned char> datagram,
+                  const udp::endpoint &sender) {
+    if (ec) {
+      std::cerr << "Receiving sensor data failed: " << ec.message() << "\n";
+      return;
+    }
+    if (auto session = session_of(sensor_bindings, sender))
+      session->on_sensor_samples(sensor_samples(datagram));
+  }
+
+public:
+  // Video is received on the video context, one port per stream, and the
+  // sensor samples on the telemetry context.
+  SessionDemux(Sessions &sessions, int video_streams, size_t receive_batch,
+               asio::io_context &video_ctx, asio::io_context &telemetry_ctx)
+      : sessions{sessions}, video_bindings(video_streams),
+        sensor_loop{bind_socket(telemetry_ctx, SENSOR_UDP_PORT),
+                    sizeof(SensorBatch), OnSensors{this}, receive_batch,
+                    256 * 1024} {
+    for (int stream = 0; stream < video_streams; ++stream)
+      video_loops.push_back(std::make_unique<ReceivingLoop<OnVideo>>(
+          bind_socket(video_ctx, video_port(stream)), MAX_VIDEO_DATAGRAM_SZ,
+          OnVideo{this, static_cast<size_t>(stream)}, receive_batch,
+          4 * 1024 * 1024));
+  }
+  SessionDemux(const SessionDemux &) = delete;
+  SessionDemux &operator=(const SessionDemux &) = delete;
+};
+
+#endif
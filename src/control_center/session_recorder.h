@@ -0,0 +1,360 @@
+#ifndef SESSION_RECORDER_H
+#define SESSION_RECORDER_H
+
+#include <array>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "compressed_image.h"
+#include "motor_packet.h"
+#include "sensor_packet.h"
+#include "video_packet.h"
+
+// A session is recorded into a directory as numbered segments. Every
+// segment is a .rec file of records and an .idx file that points to a
+// record at least once a second, both start with a SegmentHeader. Records
+// are only ever appended and are 8 byte aligned, in host byte order, so
+// the files can be memory mapped and the index binary searched by time.
+namespace recording {
+
+enum class RecordType : uint32_t {
+  VideoFrame = 1, // VideoFrameRecord followed by the JPEG as it was received
+  SensorSamples,  // SensorSample array
+  MotorCommand,   // MotorCommand as it was sent
+};
+
+struct SegmentHeader {
+  char magic[8]; // "CCREC01" or "CCIDX01"
+  uint32_t segment;
+  uint32_t reserved;
+  int64_t start_time_us;        // steady clock, like all times
+  int64_t start_system_time_us; // wall clock at the same instant
+};
+
+struct RecordHeader {
+  RecordType type;
+  uint32_t size; // of the payload, which is padded to 8 bytes
+  int64_t time_us;
+};
+
+struct VideoFrameRecord {
+  uint32_t frame_id;
+  uint32_t stream;          // the camera, see video_port
+  uint64_t capture_time_us; // on the sender's clock
+};
+
+struct IndexEntry {
+  int64_t time_us;
+  uint64_t offset; // of the RecordHeader in the .rec file
+};
+
+} // namespace recording
+
+// Records received frames, sensor samples and sent motor commands. The
+// receiving and rendering threads only copy the data into a recycled buffer
+// and queue it, a writer thread does the file I/O. If the disk can't keep
+// up, records beyond the queue limit are dropped rather than waited for.
+// Without a directory nothing is recorded.
+//
+// All memory the recorder holds counts against max_bytes: the queues have a
+// fixed number of slots, allocated up front, and the rest goes to payload
+// buffers, which are counted at their capacity whether they are queued or
+// free. Buffers come in size classes, four to a power of two, so that a
+// free one that fits is found without a search. The largest free buffers
+// are given up when a record needs room for a new one.
+class SessionRecorder {
+private:
+  using clock = std::chrono::steady_clock;
+  static constexpr uint64_t segment_size = 256 << 20;
+  static constexpr int64_t index_interval_us = 1'000'000;
+
+  struct Record {
+    recording::RecordHeader header;
+    std::vector<unsigned char> payload;
+  };
+
+  using Buffer = std::vector<unsigned char>;
+  // the share of max_bytes that goes to the slots of the queues
+  static constexpr size_t slot_share = 16;
+  // a record in the queue and in the writer's batch, and up to two free
+  // buffers
+  static constexpr size_t slot_size =
+      2 * sizeof(Record) + 2 * (sizeof(Buffer) + sizeof(uint32_t));
+  static constexpr size_t class_count = 4 * 64;
+  static constexpr uint32_t no_buffer = UINT32_MAX;
+
+  std::filesystem::path directory;
+  const size_t max_records; // queued at once
+  const size_t max_buffer_bytes;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::vector<Record> queue;
+  // Free buffers, in lists by size class that are linked through
+  // next_buffer. Places that hold no buffer are in a list of their own.
+  std::vector<Buffer> free_buffers;
+  std::vector<uint32_t> next_buffer;
+  std::array<uint32_t, class_count> free_lists;
+  uint32_t unused{no_buffer};
+  size_t queued_records{0}; // including the ones being copied
+  size_t buffer_bytes{0};   // capacity of every payload buffer
+  uint64_t dropped{0};
+  bool stopping{false};
+
+  // writer thread only
+  std::vector<Record> batch;
+  std::ofstream records, index;
+  uint32_t segment{0};
+  uint64_t offset{0};
+  int64_t next_index_time_us{INT64_MIN};
+  uint64_t written{0};
+  bool failed{false};
+  std::thread writer;
+
+  static int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               clock::now().time_since_epoch())
+        .count();
+  }
+
+  // The classes are 4, 5, 6, 7, 8, 10, 12, 14, 16, 20... bytes.
+  static size_t size_class(size_t size) {
+    size = std::max<size_t>(size, 4);
+    const size_t bits = std::bit_width(size - 1);
+    size_t shift = bits > 3 ? bits - 3 : 0;
+    size_t steps = (size + (size_t{1} << shift) - 1) >> shift;
+    if (steps == 8) {
+      steps = 4;
+      ++shift;
+    }
+    return shift * 4 + steps - 4;
+  }
+  static size_t class_size(size_t size_class) {
+    return (4 + size_class % 4) << (size_class / 4);
+  }
+
+  // with the mutex held
+  void push_free(Buffer &&buffer) {
+    if (unused == no_buffer) {
+      buffer_bytes -= buffer.capacity(); // no place left, let it go
+      buffer = {};
+      return;
+    }
+    const uint32_t i = unused;
+    unused = next_buffer[i];
+    // the largest class the buffer holds all records of
+    size_t size_class = this->size_class(buffer.capacity());
+    if (class_size(size_class) > buffer.capacity())
+      --size_class;
+    free_buffers[i] = std::move(buffer);
+    next_buffer[i] = free_lists[size_class];
+    free_lists[size_class] = i;
+  }
+  Buffer pop_free(size_t size_class) {
+    const uint32_t i = free_lists[size_class];
+    free_lists[size_class] = next_buffer[i];
+    next_buffer[i] = unused;
+    unused = i;
+    return std::move(free_buffers[i]);
+  }
+  // gives up the largest free buffer, returns false if there is none
+  bool release_largest() {
+    for (size_t size_class = class_count; size_class-- > 0;) {
+      if (free_lists[size_class] == no_buffer)
+        continue;
+      buffer_bytes -= pop_free(size_class).capacity();
+      return true;
+    }
+    return false;
+  }
+
+  template <typename... Parts>
+  void record(recording::RecordType type, Parts... parts) {
+    if (directory.empty())
+      return;
+    const size_t size = (parts.size() + ...);
+    Buffer payload;
+    {
+      std::lock_guard lock{mutex};
+      if (queued_records == max_records) {
+        ++dropped;
+        return;
+      }
+      // every buffer of the record's class fits it
+      const size_t size_class = this->size_class(size);
+      if (free_lists[size_class] != no_buffer) {
+        payload = pop_free(size_class);
+      } else {
+        const size_t growth = class_size(size_class);
+        while (buffer_bytes + growth > max_buffer_bytes) {
+          if (!release_largest()) {
+            ++dropped;
+            return;
+          }
+        }
+        buffer_bytes += growth;
+      }
+      ++queued_records;
+    }
+    if (payload.capacity() == 0)
+      payload.reserve(class_size(size_class(size)));
+    payload.resize(size);
+    size_t pos = 0;
+    ((std::memcpy(payload.data() + pos, parts.data(), parts.size()),
+      pos += parts.size()),
+     ...);
+
+    std::lock_guard lock{mutex};
+    queue.push_back({{type, static_cast<uint32_t>(size), now_us()},
+                     std::move(payload)});
+    wake.notify_one();
+  }
+
+  static std::filesystem::path segment_path(const std::filesystem::path &dir,
+                                            uint32_t segment,
+                                            const char *extension) {
+    std::ostringstream name;
+    name << std::setw(6) << std::setfill('0') << segment << extension;
+    return dir / name.str();
+  }
+
+  void open_segment(int64_t time_us) {
+    records.close();
+    index.close();
+    ++segment;
+    records.open(segment_path(directory, segment, ".rec"), std::ios::binary);
+    index.open(segment_path(directory, segment, ".idx"), std::ios::binary);
+    recording::SegmentHeader header{
+        "CCREC01", segment, 0, time_us,
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count()};
+    records.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    std::memcpy(header.magic, "CCIDX01", 8);
+    index.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    offset = sizeof(header);
+    next_index_time_us = INT64_MIN;
+  }
+
+  void write(const Record &record) {
+    const auto &header = record.header;
+    if (!records.is_open() || offset >= segment_size)
+      open_segment(header.time_us);
+    if (header.time_us >= next_index_time_us) {
+      const recording::IndexEntry entry{header.time_us, offset};
+      index.write(reinterpret_cast<const char *>(&entry), sizeof(entry));
+      next_index_time_us = header.time_us + index_interval_us;
+    }
+    static constexpr char padding[8]{};
+    const size_t padded = (header.size + 7) / 8 * 8;
+    records.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    records.write(reinterpret_cast<const char *>(record.payload.data()),
+                  header.size);
+    records.write(padding, padded - header.size);
+    offset += sizeof(header) + padded;
+    ++written;
+  }
+
+  void run() {
+    while (true) {
+      {
+        std::unique_lock lock{mutex};
+        wake.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (queue.empty())
+          return;
+        std::swap(batch, queue);
+        queued_records -= batch.size();
+      }
+      if (!failed) {
+        for (const auto &record : batch)
+          write(record);
+        records.flush();
+        index.flush();
+        if (!records || !index) {
+          std::cerr << "Could not write recording, stopped recording\n";
+          failed = true;
+        }
+      }
+      std::lock_guard lock{mutex};
+      for (auto &record : batch)
+        push_free(std::move(record.payload));
+      batch.clear();
+    }
+  }
+
+public:
+  // Appends to the segments already in directory, if there are any.
+  SessionRecorder(const std::optional<std::filesystem::path> &dir,
+                  size_t max_bytes = 64 << 20)
+      : max_records{max_bytes / slot_share / slot_size},
+        max_buffer_bytes{max_bytes - max_records * slot_size} {
+    if (!dir)
+      return;
+    if (max_records == 0)
+      throw std::runtime_error("The recording budget of " +
+                               std::to_string(max_bytes) +
+                               " bytes is too small");
+    queue.reserve(max_records);
+    batch.reserve(max_records);
+    free_buffers.resize(2 * max_records);
+    next_buffer.resize(2 * max_records);
+    for (size_t i = 0; i < next_buffer.size(); ++i)
+      next_buffer[i] = i + 1 < next_buffer.size() ? i + 1 : no_buffer;
+    unused = 0;
+    free_lists.fill(no_buffer);
+    directory = *dir;
+    std::filesystem::create_directories(directory);
+    while (std::filesystem::exists(
+        segment_path(directory, segment + 1, ".rec")))
+      ++segment;
+    writer = std::thread{[this] { run(); }};
+  }
+  SessionRecorder(const SessionRecorder &) = delete;
+  SessionRecorder &operator=(const SessionRecorder &) = delete;
+  // writes out what is still queued
+  ~SessionRecorder() {
+    if (directory.empty())
+      return;
+    {
+      std::lock_guard lock{mutex};
+      stopping = true;
+      wake.notify_one();
+    }
+    writer.join();
+    std::cout << "Recorded " << written << " records, dropped " << dropped
+              << '\n';
+  }
+
+  void record_frame(const CompressedImage &frame, const FragmentHeader &header,
+                    uint32_t stream) {
+    const recording::VideoFrameRecord video{header.frame_id, stream,
+                                            header.capture_time_us};
+    record(recording::RecordType::VideoFrame,
+           std::as_bytes(std::span{&video, 1}),
+           std::as_bytes(std::span{frame.data.get(), frame.size}));
+  }
+  void record_sensor_samples(std::span<const SensorSample> samples) {
+    if (!samples.empty())
+      record(recording::RecordType::SensorSamples, std::as_bytes(samples));
+  }
+  void record_motor_command(const MotorCommand &command) {
+    record(recording::RecordType::MotorCommand,
+           std::as_bytes(std::span{&command, 1}));
+  }
+};
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef STREAM_STATS_H
+#define STREAM_STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+#include "frame_stats.h"
+#include "tripplebuffer.h"
+
+// Collects the statistics of a video stream on the thread that receives it.
+// A snapshot is published once per period, by the first datagram or timer
+// tick after the period has run out, and can be picked up by another thread
+// with take. The tick keeps snapshots coming while no datagrams do.
+class StreamStats {
+private:
+  using clock = std::chrono::steady_clock;
+  struct Snapshot {
+    FrameStats stats;
+    bool fresh;
+  };
+  TrippleBuffer<Snapshot>::Storage storage{};
+  TrippleBuffer<Snapshot> snapshots{storage};
+  const clock::duration period;
+
+  FrameStats stats{};
+  clock::time_point window_start{clock::now()};
+  size_t window_bytes{0};
+  size_t window_frames{0};
+  size_t window_frame_bytes{0};
+  clock::duration window_frametime{};
+
+  bool has_frame{false};
+  uint32_t last_frame_id{};
+  clock::time_point last_arrival;
+  clock::duration last_frametime{};
+  // frames are counted once, however many of their datagrams come in
+  uint32_t last_duplicate_id{}, last_reordered_id{};
+
+  void publish(clock::time_point now) {
+    const double seconds =
+        std::chrono::duration<double>(now - window_start).count();
+    stats.bytes_per_second = window_bytes / seconds;
+    stats.frametime =
+        window_frames
+            ? window_frametime / static_cast<clock::rep>(window_frames)
+            : clock::duration{};
+    stats.framesize = window_frames ? window_frame_bytes / window_frames : 0;
+
+    snapshots.get_back_buffer() = {stats, true};
+    snapshots.swap_back();
+
+    window_start = now;
+    window_bytes = window_frames = window_frame_bytes = 0;
+    window_frametime = {};
+  }
+
+public:
+  StreamStats(clock::duration period = std::chrono::milliseconds{500})
+      : period{period} {}
+
+  void on_datagram(size_t bytes) {
+    const auto now = clock::now();
+    window_bytes += bytes;
+    if (now - window_start >= period)
+      publish(now);
+  }
+
+  // to be called about once per period on the receiving thread
+  void on_tick() {
+    const auto now = clock::now();
+    if (now - window_start >= period)
+      publish(now);
+  }
+  clock::duration publish_period() const { return period; }
+
+  void on_frame(uint32_t frame_id, size_t size) {
+    const auto now = clock::now();
+    ++stats.frames_received;
+    if (has_frame) {
+      // frame ids are consecutive, the ones skipped never got completed
+      stats.frames_lost += frame_id - last_frame_id - 1;
+      const auto frametime = now - last_arrival;
+      window_frametime += frametime;
+      ++window_frames;
+      window_frame_bytes += size;
+      // smoothed like the interarrival jitter of RFC 3550
+      const auto deviation = std::chrono::abs(frametime - last_frametime);
+      stats.jitter += (deviation - stats.jitter) / 16;
+      last_frametime = frametime;
+    }
+    has_frame = true;
+    last_frame_id = frame_id;
+    last_arrival = now;
+  }
+
+  // The sender started over, the ids of its next frame don't follow on from
+  // the last one. The counts go on.
+  void restart() {
+    has_frame = false;
+    last_frametime = {};
+  }
+
+  // a datagram that was received before came in again
+  void on_duplicate(uint32_t frame_id) {
+    if (stats.frames_duplicated && last_duplicate_id == frame_id)
+      return;
+    ++stats.frames_duplicated;
+    last_duplicate_id = frame_id;
+  }
+
+  // a datagram of a frame older than the one completed last came in
+  void on_reordered(uint32_t frame_id) {
+    if (stats.frames_reordered && last_reordered_id == frame_id)
+      return;
+    ++stats.frames_reordered;
+    last_reordered_id = frame_id;
+  }
+
+  // Returns the latest snapshot if it hasn't been taken yet.
+  std::optional<FrameStats> take() {
+    snapshots.swap_front();
+    auto &snapshot = snapshots.get_front_buffer();
+    if (!snapshot.fresh)
+      return std::nullopt;
+    snapshot.fresh = false;
+    return snapshot.stats;
+  }
+};
+
+#endif
@@ -2,75 +2,186 @@
 #define TEXTURE_UPDATE_DATA_H
 
 #include <asio.hpp>
+#include <chrono>
+#include <cstring>
+#include <iostream>
 #include <jpgd.h>
+#include <span>
 
+#include "compressed_image.h"
 #include "gui_context.h"
-#include "tripplebuffer.h"
+#include "video_packet.h"
+#include "jpeg_decoder.h"
+#include "playout_buffer.h"
 
-struct ReceivedPixel {
-  char r, g, b;
-};
 class TextureUpdateData {
 private:
+  const Texture &texture;
   const size_t width, height;
-  std::unique_ptr<Pixel[]> decompressed;
   const size_t compressed_data_cap;
-  struct CompressedImage {
-    std::unique_ptr<jpgd::uint8[]> data;
-    size_t size;
-  };
-  TrippleBuffer<CompressedImage>::Storage compressed_data_storage;
-  TrippleBuffer<CompressedImage> compressed_data;
+  const JpegDecoder::ChromaFilter chroma_filter;
+  PlayoutBuffer playout;
+  CompressedImage current;
+  JpegDecoder decoder;
+  std::chrono::steady_clock::duration decode_time{};
+  // the sender may scale frames down, they are shown from the top left
+  size_t _image_width, _image_height;
+
+  // Fallback for frames JpegDecoder doesn't handle, such as progressive ones.
+  // jpgd sets up a new decoder, and thus allocates, for every frame. It
+  // decodes row by row into the texture, the rows after one it fails on are
+  // filled with magenta.
+  void decompress_with_jpgd(std::span<const unsigned char> jpeg) {
+    jpgd::jpeg_decoder_mem_stream stream{
+        jpeg.data(), static_cast<jpgd::uint>(jpeg.size())};
+    jpgd::jpeg_decoder decoder{
+        &stream, chroma_filter == JpegDecoder::ChromaFilter::Nearest
+                     ? jpgd::jpeg_decoder::cFlagBoxChromaFiltering
+                     : 0u};
+    if (decoder.get_error_code() != jpgd::JPGD_SUCCESS ||
+        decoder.get_width() > width || decoder.get_height() > height ||
+        decoder.begin_decoding() != jpgd::JPGD_SUCCESS) {
+      std::cout << "Could not decode texture\n";
+      return;
+    }
+    _image_width = decoder.get_width();
+    _image_height = decoder.get_height();
+
+    const auto lock = texture.lock(_image_width, _image_height);
+    const bool grayscale = decoder.get_bytes_per_pixel() == 1;
+    bool failed = false;
+    for (size_t y = 0; y < _image_height; ++y) {
+      auto row = reinterpret_cast<Pixel *>(lock.pixels() + y * lock.pitch());
+      const void *scan_line;
+      jpgd::uint scan_line_len;
+      if (!failed)
+        failed = decoder.decode(&scan_line, &scan_line_len) !=
+                 jpgd::JPGD_SUCCESS;
+      if (failed) {
+        std::fill_n(row, _image_width, Pixel{255, 0, 255, 255});
+        continue;
+      }
+      if (!grayscale) { // jpgd already outputs RGBA
+        std::memcpy(row, scan_line, _image_width * 4);
+        continue;
+      }
+      auto gray = static_cast<const unsigned char *>(scan_line);
+      for (size_t x = 0; x < _image_width; ++x)
+        row[x] = {gray[x], gray[x], gray[x], 255};
+    }
+    if (failed)
+      std::cout << "Could not decode texture\n";
+  }
 
+  // Decodes straight into the texture memory. Only the part the frame covers
+  // is locked, and only once the frame has been decoded, so that a frame
+  // that fails leaves the texture as it was.
   void decompress(const CompressedImage &compressed) {
-    int w, h, comps;
-    jpgd::uint8 *pDecompressed = jpgd::decompress_jpeg_image_from_memory(
-        compressed.data.get(), compressed.size, &w, &h, &comps, 3);
-    if (!pDecompressed || w != width || h != height || comps != 3) {
-      free(pDecompressed);
-      std::cout << "Received incompatible texture";
+    const std::span<const unsigned char> jpeg{compressed.data.get(),
+                                              compressed.size};
+    if (!decoder.prepare(jpeg, width, height)) {
+      decompress_with_jpgd(jpeg);
       return;
     }
-    auto rcvd = reinterpret_cast<ReceivedPixel *>(pDecompressed);
+    if (!decoder.decode_blocks()) {
+      std::cout << "Could not decode texture\n";
+      return;
+    }
+    _image_width = decoder.width();
+    _image_height = decoder.height();
+    const auto lock = texture.lock(_image_width, _image_height);
+    decoder.write_rgba(lock.pixels(), lock.pitch());
+  }
 
-    for (int i = 0; i < w * h; ++i) {
-      decompressed[i].r = rcvd[i].r;
-      decompressed[i].g = rcvd[i].g;
-      decompressed[i].b = rcvd[i].b;
+  // leaves the color conversion to the renderer
+  void decompress_planar(const CompressedImage &compressed) {
+    if (!decoder.prepare({compressed.data.get(), compressed.size}, width,
+                         height)) {
+      std::cout << "Received incompatible texture\n";
+      return;
+    }
+    if (!decoder.decode()) {
+      std::cout << "Could not decode texture\n";
+      return;
     }
+    _image_width = decoder.width();
+    _image_height = decoder.height();
+    const auto y = decoder.y();
+    const auto cb = decoder.cb();
+    const auto cr = decoder.cr();
+    texture.update_yuv(_image_width, _image_height, y.data, y.pitch, cb.data,
+                       cb.pitch, cr.data, cr.pitch);
+  }
 
-    free(pDecompressed); // TODO: avoid copy
+  void fill_magenta() {
+    if (texture.format() == PixelFormat::YUV) {
+      const size_t chroma_width = (width + 1) / 2;
+      const std::vector<unsigned char> y(width * height, 105);
+      const std::vector<unsigned char> cb(chroma_width * (height + 1) / 2, 212);
+      const std::vector<unsigned char> cr(chroma_width * (height + 1) / 2, 235);
+      texture.update_yuv(width, height, y.data(), width, cb.data(),
+                         chroma_width, cr.data(), chroma_width);
+      return;
+    }
+    const auto lock = texture.lock();
+    for (size_t y = 0; y < height; ++y) {
+      auto row = reinterpret_cast<Pixel *>(lock.pixels() + y * lock.pitch());
+      std::fill_n(row, width, Pixel{255, 0, 255, 255});
+    }
   }
 
 public:
-  TextureUpdateData(const Texture &tex)
-      : width{tex.width()}, height{tex.height()},
-        decompressed{std::make_unique<Pixel[]>(width * height)},
-        compressed_data_cap{width * height * 3},
-        compressed_data_storage{
-            {std::make_unique<jpgd::uint8[]>(compressed_data_cap), 0},
-            {std::make_unique<jpgd::uint8[]>(compressed_data_cap), 0},
-            {std::make_unique<jpgd::uint8[]>(compressed_data_cap), 0}},
-        compressed_data{compressed_data_storage} {
-    for (int i = 0; i < width * height; ++i) {
-      decompressed[i] = {255, 0, 255, 255};
-    }
+  // Frames of up to frame_capacity bytes are taken.
+  TextureUpdateData(const Texture &tex, PlayoutBuffer::Mode playout_mode,
+                    JpegDecoder::ChromaFilter chroma_filter,
+                    size_t frame_capacity, WorkerPool &decode_pool)
+      : texture{tex}, width{tex.width()}, height{tex.height()},
+        compressed_data_cap{frame_capacity}, chroma_filter{chroma_filter},
+        playout{playout_mode, compressed_data_cap},
+        current{std::make_unique<unsigned char[]>(compressed_data_cap), 0},
+        decoder{decode_pool, chroma_filter}, _image_width{width},
+        _image_height{height} {
+    fill_magenta();
+  }
+  // Decodes the frame that is due into the texture, if there is one, and
+  // returns whether there was. The texture isn't touched otherwise.
+  bool update() {
+    if (!playout.take(current))
+      return false;
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+    if (texture.format() == PixelFormat::YUV)
+      decompress_planar(current);
+    else
+      decompress(current);
+    decode_time += (clock::now() - start - decode_time) / 8;
+    return true;
+  }
+  size_t frame_capacity() const { return compressed_data_cap; }
+  // smoothed time it takes to decode and upload a frame
+  std::chrono::steady_clock::duration frame_decode_time() const {
+    return decode_time;
   }
-  Pixel *data() {
-    compressed_data.swap_front();
-    if (compressed_data.get_front_buffer().size)
-      decompress(compressed_data.get_front_buffer());
-    compressed_data.get_front_buffer().size = 0;
-    return decompressed.get();
+  // Takes over a completely received frame by swapping buffers with the
+  // playout buffer, frame must have been allocated with frame_capacity()
+  // bytes.
+  void submit_frame(CompressedImage &frame, const FragmentHeader &header) {
+    playout.submit(frame, header.frame_id, header.capture_time_us);
   }
-  auto begin_receiving_data() {
-    return asio::buffer(compressed_data.get_back_buffer().data.get(),
-                        compressed_data_cap);
+  // drops the frames that wait for playout, the sender started over
+  void reset_playout() { playout.reset(); }
+  // when update() has the next frame to decode, max() if none is queued
+  std::chrono::steady_clock::time_point next_frame_time() {
+    return playout.next_playout_time();
   }
-  void end_receiving_data(size_t compressed_bytes) {
-    compressed_data.get_back_buffer().size = compressed_bytes;
-    compressed_data.swap_back();
+  std::chrono::steady_clock::duration playout_delay() {
+    return playout.playout_delay();
   }
+  uint64_t skipped_frames() { return playout.skipped_frames(); }
+  size_t queued_frames() { return playout.queued_frames(); }
+  // part of the texture the last frame was decoded into
+  size_t image_width() const { return _image_width; }
+  size_t image_height() const { return _image_height; }
 };
 
 #endif
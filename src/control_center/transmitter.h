@@ -1,37 +1,151 @@
 #ifndef TRANSMITTER_H
 #define TRANSMITTER_H
 
+#include <array>
 #include <asio.hpp>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
 
 #include "address.h"
 
+// Sends small messages over a TCP connection. Every message is copied into
+// a fixed number of slots on the strand the socket is used on, and all that
+// are queued go out in one gathering write, one write at a time. When the
+// connection can't keep up and all slots are taken, the oldest message that
+// isn't being written yet is dropped, an outdated command is worth less than
+// a new one. Messages sent while not connected are discarded.
 class Transmitter {
+public:
+  static constexpr size_t max_message_size = 64;
+  static constexpr size_t capacity = 16;
+
+private:
   using tcp = asio::ip::tcp;
+  struct Message {
+    std::array<unsigned char, max_message_size> data;
+    size_t size;
+  };
+
+  asio::strand<asio::io_context::executor_type> strand;
   tcp::resolver resolver;
   tcp::socket socket;
+  bool connected{false};
+  uint32_t connection{0}; // tells the writes of an old connection apart
+
+  // ring of queued messages, the first in_flight ones are being written
+  std::array<Message, capacity> queue;
+  size_t head{0}, size{0}, in_flight{0};
+  std::vector<asio::const_buffer> buffers;
+  std::atomic<uint64_t> dropped_messages{0};
+
+  Message &at(size_t i) { return queue[(head + i) % capacity]; }
+
+  void enqueue(const Message &message) {
+    if (!connected)
+      return;
+    if (size == capacity) {
+      // writes take at most capacity - 1 messages, so one is waiting
+      for (size_t i = in_flight; i + 1 < size; ++i)
+        at(i) = at(i + 1);
+      --size;
+      dropped_messages.fetch_add(1, std::memory_order_relaxed);
+    }
+    at(size++) = message;
+    if (!in_flight)
+      write();
+  }
+
+  void write() {
+    in_flight = std::min(size, capacity - 1);
+    buffers.clear();
+    for (size_t i = 0; i < in_flight; ++i)
+      buffers.push_back(asio::buffer(at(i).data.data(), at(i).size));
+    asio::async_write(
+        socket, buffers,
+        asio::bind_executor(strand, [this, generation = connection](
+                                        asio::error_code ec, std::size_t) {
+          head = (head + in_flight) % capacity;
+          size -= in_flight;
+          in_flight = 0;
+          if (ec && generation == connection)
+            disconnect();
+          else if (size)
+            write();
+        }));
+  }
+
+  void disconnect() {
+    connected = false;
+    asio::error_code ec;
+    socket.close(ec);
+    // a write that is still in flight completes with an error
+    size = in_flight;
+  }
 
 public:
-  Transmitter(asio::io_context &ctx) : resolver{ctx}, socket{ctx} {}
+  Transmitter(asio::io_context &ctx)
+      : strand{asio::make_strand(ctx)}, resolver{strand}, socket{strand} {
+    buffers.reserve(capacity);
+  }
 
   template <typename F>
   void async_connect(std::string_view host, std::string_view service,
                      F &&handler) {
-    socket.close();
-    resolver.cancel();
-    resolver.async_resolve(
-        host, service,
-        [&](const asio::error_code &ec, tcp::resolver::results_type results) {
-          if (!ec) {
-            asio::async_connect(socket, results, handler);
-          } else {
-            handler(ec, tcp::endpoint{});
-          }
-        });
-  }
-  Address remote_address() const { return Address{socket.remote_endpoint()}; }
-  template <typename T, typename F> void async_send(const T &pod, F &&handler) {
-    asio::async_write(socket, asio::buffer(&pod, sizeof(pod)), handler);
+    asio::post(strand, [this, host = std::string{host},
+                        service = std::string{service},
+                        handler = std::forward<F>(handler)]() mutable {
+      disconnect();
+      resolver.cancel();
+      resolver.async_resolve(
+          host, service,
+          [this, handler = std::move(handler)](
+              const asio::error_code &ec,
+              tcp::resolver::results_type results) mutable {
+            if (ec) {
+              handler(ec, tcp::endpoint{});
+              return;
+            }
+            asio::async_connect(
+                socket, results,
+                [this, handler = std::move(handler)](
+                    const asio::error_code &ec,
+                    const tcp::endpoint &endpoint) mutable {
+                  // commands are small and have to go out right away
+                  if (!ec) {
+                    socket.set_option(tcp::no_delay{true});
+                    connected = true;
+                    ++connection;
+                  }
+                  handler(ec, endpoint);
+                });
+          });
+    });
+  }
+
+  // Queues a copy of pod, can be called from any thread.
+  template <typename T> void send(const T &pod) {
+    static_assert(std::is_trivially_copyable_v<T> &&
+                  sizeof(T) <= max_message_size);
+    Message message;
+    std::memcpy(message.data.data(), &pod, sizeof(pod));
+    message.size = sizeof(pod);
+    asio::post(strand, [this, message] { enqueue(message); });
+  }
+  template <typename T, typename F> void async_receive(T &pod, F &&handler) {
+    asio::post(strand, [this, &pod, handler = std::forward<F>(handler)] {
+      asio::async_read(socket, asio::buffer(&pod, sizeof(pod)), handler);
+    });
+  }
+
+  // messages dropped because the connection couldn't keep up
+  uint64_t dropped() const {
+    return dropped_messages.load(std::memory_order_relaxed);
   }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -48,8 +48,10 @@ public:
   // producer thread interface
   [[nodiscard]] T &get_back_buffer() noexcept { return *back; };
   [[nodiscard]] const T &get_back_buffer() const noexcept { return *back; };
+  // Both swaps acquire and release, a buffer handed over by one side is
+  // reused by the other once it comes back around.
   void swap_back() noexcept {
-    back = middle.exchange(back, std::memory_order_release);
+    back = middle.exchange(back, std::memory_order_acq_rel);
   };
 
 public:
@@ -57,7 +59,7 @@ public:
   [[nodiscard]] T &get_front_buffer() noexcept { return *front; };
   [[nodiscard]] const T &get_front_buffer() const noexcept { return *front; };
   void swap_front() noexcept {
-    front = middle.exchange(front, std::memory_order_acquire);
+    front = middle.exchange(front, std::memory_order_acq_rel);
   };
 
 public:
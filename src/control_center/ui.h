@@ -1,34 +1,47 @@
 #ifndef UI_H
 #define UI_H
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <imgui.h>
 #include <implot.h>
 #include <optional>
 #include <sstream>
+#include <string>
 #include <string_view>
+#include <vector>
 
 #include "address.h"
 #include "frame_stats.h"
 #include "gui_context.h"
 #include "motor_data.h"
+#include "motor_link.h"
+#include "motor_stats.h"
 #include "sensor_data.h"
 
 class UI {
 public:
-  UI(std::optional<Address> &address, const Texture &img,
-     const SensorData &sensor_data)
-      : current_address{address}, camera_view{img}, sensor_data{sensor_data} {}
+  // With more than one vehicle, the windows of each carry its name and one
+  // of them is driven with the gamepad, the one whose index is selected.
+  UI(std::string vehicle, int index, SensorData &sensor_data)
+      : vehicle{std::move(vehicle)}, index{index},
+        control_title{title("Control Center")},
+        sensor_title{title("Sensor Data")}, sensor_data{sensor_data} {}
 
   template <typename F>
-  void update(MotorData &motor_data, F &&reconnect_handler) {
-    if (ImGui::Begin("Control Center")) {
+  void update(MotorData &motor_data, F &&reconnect_handler,
+              int &driven_vehicle) {
+    if (ImGui::Begin(control_title.c_str())) {
       // Update address
       {
         const bool changed = ImGui::InputText("Host", host, bufsz);
 
         ImGui::BeginDisabled();
-        ImGui::InputText("Service", service, bufsz);
-        strcpy(service, MOTOR_TCP_PORT);
+        ImGui::InputText(motor_channel == MotorLink::Channel::Udp
+                             ? "Service (UDP)"
+                             : "Service (TCP)",
+                         service, bufsz);
         ImGui::EndDisabled();
 
         if (changed) {
@@ -38,10 +51,19 @@ public:
         if (current_address.has_value()) {
           std::stringstream temp{};
           temp << *current_address;
-          ImGui::Text("%s", ("Connected to " + temp.str()).c_str());
+          // there is no handshake over UDP, the first acknowledgement shows
+          // that the vehicle is there
+          if (motor_channel == MotorLink::Channel::Udp &&
+              !motor_stats.commands_acked)
+            ImGui::Text("%s", ("Waiting for " + temp.str()).c_str());
+          else
+            ImGui::Text("%s", ("Connected to " + temp.str()).c_str());
         } else {
           ImGui::Text("Connecting...");
         }
+        if (!vehicle.empty())
+          ImGui::RadioButton("Driven with the gamepad", &driven_vehicle,
+                             index);
       }
 
       // Update motor data
@@ -55,22 +77,48 @@ public:
       // Display FPS
       ImGui::Text("GUI Rendering Performance: %.3f ms/frame (%.1f FPS)",
                   1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
-      const float fps = 1e9f / frame_stats.frametime.count();
-      constexpr float max_packet_sz = 65507;
-      constexpr float bytes_to_megabits = 1.0f / 1024.0f / 1024.0f * 8.0f;
-      ImGui::Text("Video Streaming Performance: %.3f ms/frame (%.1f FPS)",
-                  frame_stats.frametime.count() / 1e6f, fps);
-      ImGui::Text("Network Performance: %.3f%% packet size used (%.3f Mbps)",
-                  frame_stats.framesize / max_packet_sz * 100.0f,
-                  fps * frame_stats.framesize * bytes_to_megabits);
+      using ms = std::chrono::duration<float, std::milli>;
+      ImGui::Text("Memory: %zu MiB budget, frames of up to %zu KiB",
+                  memory_budget >> 20, frame_capacity >> 10);
+      for (const auto &camera : cameras) {
+        if (cameras.size() > 1)
+          ImGui::Text("%s", camera.name.c_str());
+        show_frame_stats(camera.stats);
+      }
+      ImGui::Text("Motor Commands: %.1f ms RTT (%.1f ms smoothed, %.1f ms "
+                  "max), %llu sent, %llu stale, %llu dropped, %llu lost, "
+                  "%u unacknowledged",
+                  ms{motor_stats.rtt}.count(),
+                  ms{motor_stats.smoothed_rtt}.count(),
+                  ms{motor_stats.max_rtt}.count(),
+                  static_cast<unsigned long long>(motor_stats.commands_sent),
+                  static_cast<unsigned long long>(motor_stats.commands_stale),
+                  static_cast<unsigned long long>(
+                      motor_stats.commands_dropped),
+                  static_cast<unsigned long long>(motor_stats.commands_lost),
+                  motor_stats.unacked);
+      if (ImGui::TreeNode("Threads")) {
+        for (const auto &thread : thread_layout)
+          ImGui::Text("%s", thread.c_str());
+        ImGui::TreePop();
+      }
     }
     ImGui::End();
 
-    if (ImGui::Begin("Camera View"))
-      ImGui::Image(camera_view.handle(), ImGui::GetContentRegionAvail());
-    ImGui::End();
+    // nothing of a collapsed window, or of one in a hidden tab, is visible
+    for (auto &camera : cameras) {
+      camera.visible = ImGui::Begin(camera.name.c_str());
+      if (camera.visible)
+        ImGui::Image(camera.view->handle(), ImGui::GetContentRegionAvail(),
+                     ImVec2{0, 0}, camera.uv);
+      ImGui::End();
+    }
 
-    if (ImGui::Begin("Sensor Data")) {
+    if (ImGui::Begin(sensor_title.c_str())) {
+      ImGui::Combo("History", &history_span, history_span_names,
+                   history_span_count);
+      const auto &snapshot = sensor_data.snapshot();
+      const double span = snapshot.span;
       static ImGuiTableFlags flags =
           ImGuiTableFlags_BordersOuter | ImGuiTableFlags_BordersV |
           ImGuiTableFlags_RowBg | ImGuiTableFlags_Resizable |
@@ -83,36 +131,62 @@ public:
         ImGui::TableSetupColumn("Graph");
         ImGui::TableHeadersRow();
         ImPlot::PushColormap(ImPlotColormap_Cool);
+        size_t width = 1;
         for (int row = 0; row < sensor_data.sensor_count; row++) {
+          const auto &sensor = snapshot.sensors[row];
+          const auto &points = sensor.points;
           ImGui::TableNextRow();
           ImGui::TableSetColumnIndex(0);
           ImGui::Text("%s", sensor_data.name(row));
           ImGui::TableSetColumnIndex(1);
-          if (!sensor_data[row].second_range().empty())
-            ImGui::Text("%f", sensor_data[row].second_range().back());
+          if (!sensor.empty)
+            ImGui::Text("%f", sensor.latest);
           else
-            ImGui::Text("%f", sensor_data[row].first_range().back());
+            ImGui::TextDisabled("-");
           ImGui::TableSetColumnIndex(2);
           ImGui::PushID(row);
 
+          width = static_cast<size_t>(
+              std::max(ImGui::GetContentRegionAvail().x, 1.0f));
+          double min_val = 0, max_val = 0;
+          if (!points.empty()) {
+            min_val = points.front().min;
+            max_val = points.front().max;
+          }
+          for (const auto &point : points) {
+            min_val = std::min(min_val, point.min);
+            max_val = std::max(max_val, point.max);
+          }
+          if (max_val - min_val < 1e-6) { // flat lines go in the middle
+            min_val -= 0.5;
+            max_val += 0.5;
+          }
+
           ImPlot::PushStyleVar(ImPlotStyleVar_PlotPadding, ImVec2(0, 0));
           if (ImPlot::BeginPlot("##graph", ImVec2(-1, 35),
                                 ImPlotFlags_CanvasOnly | ImPlotFlags_NoChild)) {
             ImPlot::SetupAxes(0, 0, ImPlotAxisFlags_NoDecorations,
                               ImPlotAxisFlags_NoDecorations);
-            ImPlot::SetupAxesLimits(0, sensor_data[row].size() - 1,
-                                    sensor_data.min_val(row),
-                                    sensor_data.max_val(row), ImGuiCond_Always);
+            ImPlot::SetupAxesLimits(sensor.latest_time - span,
+                                    sensor.latest_time, min_val, max_val,
+                                    ImGuiCond_Always);
             ImPlot::PushStyleColor(ImPlotCol_Line,
                                    ImPlot::GetColormapColor(row));
-            ImPlot::PlotLine("##graph", sensor_data[row].first_range().data(),
-                             sensor_data[row].first_range().size(), 1, 0, 0);
-            ImPlot::PlotLine("##graph", sensor_data[row].second_range().data(),
-                             sensor_data[row].second_range().size(), 1,
-                             sensor_data[row].first_range().size(), 0);
-            ImPlot::PushStyleVar(ImPlotStyleVar_FillAlpha, 0.25f);
-            ImPlot::PopStyleVar();
-            ImPlot::PopStyleColor();
+            ImPlot::PushStyleColor(ImPlotCol_Fill,
+                                   ImPlot::GetColormapColor(row));
+            if (!points.empty()) {
+              // the range of the readings behind every point
+              const auto &first = points.front();
+              const int count = points.size();
+              constexpr int stride = sizeof(SensorHistory::Point);
+              ImPlot::PushStyleVar(ImPlotStyleVar_FillAlpha, 0.25f);
+              ImPlot::PlotShaded("##range", &first.time, &first.min,
+                                 &first.max, count, 0, 0, stride);
+              ImPlot::PopStyleVar();
+              ImPlot::PlotLine("##graph", &first.time, &first.mean, count, 0,
+                               0, stride);
+            }
+            ImPlot::PopStyleColor(2);
             ImPlot::EndPlot();
           }
           ImPlot::PopStyleVar();
@@ -120,27 +194,108 @@ public:
         }
         ImPlot::PopColormap();
         ImGui::EndTable();
+        // about one point per pixel, whatever the span
+        sensor_data.set_view(history_spans[history_span], width);
       }
     }
     ImGui::End();
   }
 
-  void set_frame_stats(const FrameStats &stats) {
-    static int cnt = 0;
-    constexpr int every = 64;
-    if (cnt++ % every == 0) {
-      frame_stats = stats;
-    }
+  // Adds a camera window, cameras are numbered in the order they are added.
+  void add_camera(std::string_view name, const Texture &view) {
+    cameras.push_back({title(name), &view});
   }
+  void set_address(const std::optional<Address> &address) {
+    current_address = address;
+  }
+  // the channel motor commands are sent over, and with it the port
+  void set_motor_channel(MotorLink::Channel channel) {
+    motor_channel = channel;
+    strcpy(service, channel == MotorLink::Channel::Udp
+                        ? std::to_string(MOTOR_UDP_PORT).c_str()
+                        : MOTOR_TCP_PORT);
+  }
+  // the memory a vehicle may take, and the frame size that leaves room for
+  void set_memory(size_t budget, size_t frame_capacity) {
+    memory_budget = budget;
+    this->frame_capacity = frame_capacity;
+  }
+  void set_frame_stats(size_t camera, const FrameStats &stats) {
+    cameras[camera].stats = stats;
+  }
+  void set_motor_stats(const MotorStats &stats) { motor_stats = stats; }
+  // a line per thread, where it runs and at which priority
+  void set_thread_layout(std::vector<std::string> layout) {
+    thread_layout = std::move(layout);
+  }
+  // the part of the camera texture the current frame fills
+  void set_camera_image_size(size_t camera, size_t width, size_t height) {
+    auto &view = *cameras[camera].view;
+    cameras[camera].uv = {static_cast<float>(width) / view.width(),
+                          static_cast<float>(height) / view.height()};
+  }
+  // whether the camera window was visible in the last frame
+  bool camera_visible(size_t camera) const { return cameras[camera].visible; }
 
 private:
+  struct Camera {
+    std::string name;
+    const Texture *view;
+    ImVec2 uv{1, 1};
+    FrameStats stats{};
+    bool visible{true};
+  };
+
+  std::string title(std::string_view window) const {
+    std::string title{window};
+    if (!vehicle.empty())
+      title += " - " + vehicle;
+    return title;
+  }
+
+  static void show_frame_stats(const FrameStats &frame_stats) {
+    using ms = std::chrono::duration<float, std::milli>;
+    const float frametime = ms{frame_stats.frametime}.count();
+    const float fps = frametime > 0 ? 1000.0f / frametime : 0;
+    constexpr float bytes_to_megabits = 1.0f / 1024.0f / 1024.0f * 8.0f;
+    ImGui::Text("Video Streaming Performance: %.3f ms/frame (%.1f FPS), "
+                "%.3f ms jitter",
+                frametime, fps, ms{frame_stats.jitter}.count());
+    ImGui::Text("Video Decoding Performance: %.3f ms/frame",
+                ms{frame_stats.decode_time}.count());
+    ImGui::Text("Playout: %.3f ms delay, %llu frames skipped",
+                ms{frame_stats.playout_delay}.count(),
+                static_cast<unsigned long long>(frame_stats.frames_skipped));
+    ImGui::Text("Network Performance: %.1f KiB/frame (%.3f Mbps)",
+                frame_stats.framesize / 1024.0f,
+                frame_stats.bytes_per_second * bytes_to_megabits);
+    ImGui::Text("Frames: %llu received, %llu lost, %llu duplicated, "
+                "%llu reordered",
+                static_cast<unsigned long long>(frame_stats.frames_received),
+                static_cast<unsigned long long>(frame_stats.frames_lost),
+                static_cast<unsigned long long>(frame_stats.frames_duplicated),
+                static_cast<unsigned long long>(frame_stats.frames_reordered));
+  }
+
   static constexpr int bufsz = 512;
+  static constexpr int history_span_count = 5;
+  static constexpr double history_spans[history_span_count] = {
+      10, 60, 10 * 60, 60 * 60, 8 * 60 * 60}; // in seconds
+  static constexpr const char *history_span_names[history_span_count] = {
+      "10 s", "1 min", "10 min", "1 h", "8 h"};
   char host[bufsz]{};
   char service[bufsz]{};
-  std::optional<Address> &current_address;
-  const Texture &camera_view;
-  const SensorData &sensor_data;
-  FrameStats frame_stats;
+  const std::string vehicle;
+  const int index;
+  const std::string control_title, sensor_title;
+  std::optional<Address> current_address;
+  MotorLink::Channel motor_channel{MotorLink::Channel::Tcp};
+  SensorData &sensor_data;
+  std::vector<Camera> cameras;
+  MotorStats motor_stats{};
+  size_t memory_budget{0}, frame_capacity{0};
+  std::vector<std::string> thread_layout;
+  int history_span{1};
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,226 @@
+#ifndef VEHICLE_SESSION_H
+#define VEHICLE_SESSION_H
+
+#include <algorithm>
+#include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "address.h"
+#include "datagram_transmitter.h"
+#include "gui_context.h"
+#include "io_thread.h"
+#include "motor_data.h"
+#include "motor_link.h"
+#include "options.h"
+#include "sensor_data.h"
+#include "sensor_packet.h"
+#include "session_recorder.h"
+#include "transmitter.h"
+#include "ui.h"
+#include "video_stream.h"
+#include "worker_pool.h"
+
+// Everything the control center keeps for one vehicle: its control channel,
+// video streams, sensor history, recording and windows. The threads, the
+// renderer and the decode pool are shared by all sessions. Video and sensor
+// datagrams arrive on ports shared by all vehicles as well and are handed to
+// the session of the vehicle that sent them, see SessionDemux.
+//
+// All memory a session needs is allocated up front and has to fit into the
+// memory budget. The frame buffers are the only part that can give, so they
+// are sized to what is left of the budget once everything else is taken.
+// Frames that don't fit are dropped by the reassembler, the sender sees
+// them lost and lowers its quality.
+class VehicleSession {
+private:
+  using clock = std::chrono::steady_clock;
+  // smaller frames wouldn't fit a usable picture
+  static constexpr size_t min_frame_capacity = 64 << 10;
+
+  const size_t memory_budget; // for everything but the recording
+  SessionRecorder recorder;
+  Transmitter transmitter;
+  DatagramTransmitter datagram_transmitter;
+  const MotorLink::Channel channel;
+  MotorLink motor_link;
+  MotorData motor_data{};
+  SensorData sensor_data;
+  std::vector<std::unique_ptr<VideoStream>> video_streams;
+  UI ui;
+
+  std::mutex address_mutex;
+  std::optional<Address> address; // guarded by address_mutex
+  // tells the senders of an earlier connection apart
+  std::atomic<uint32_t> connection{0};
+
+  static std::string name(int index, int vehicle_count) {
+    return vehicle_count > 1 ? "Vehicle " + std::to_string(index + 1) : "";
+  }
+  // when recording, a quarter of the budget goes to the records that wait
+  // for the disk
+  static size_t recording_budget(const Options &options) {
+    return options.record_directory ? options.vehicle_memory / 4 : 0;
+  }
+  static std::optional<std::filesystem::path>
+  record_directory(const Options &options, int index) {
+    if (!options.record_directory || options.vehicles == 1)
+      return options.record_directory;
+    return *options.record_directory /
+           ("vehicle-" + std::to_string(index + 1));
+  }
+
+  // what is left of the budget for every frame buffer
+  size_t frame_capacity(const Options &options) const {
+    const size_t streams = options.video_streams;
+    const size_t fixed =
+        sensor_data.memory() +
+        streams * VideoStream::fixed_memory(options.video_format);
+    const size_t capacity =
+        memory_budget > fixed ? (memory_budget - fixed) /
+                                    (streams * VideoStream::frame_buffers)
+                              : 0;
+    if (capacity < min_frame_capacity)
+      throw std::runtime_error(
+          "A vehicle needs more than " +
+          std::to_string(options.vehicle_memory >> 20) +
+          " MiB of memory for " + std::to_string(streams) + " video streams");
+    // a frame can't be larger than its raw pixels
+    return std::min(capacity, VideoStream::width * VideoStream::height * 3);
+  }
+
+  void set_address(std::optional<Address> value) {
+    std::lock_guard lock{address_mutex};
+    address = value;
+  }
+
+public:
+  VehicleSession(int index, const Options &options, IoThread &video_thread,
+                 IoThread &control_thread, GUIContext &gui_ctx,
+                 WorkerPool &decode_pool)
+      : memory_budget{options.vehicle_memory - recording_budget(options)},
+        recorder{record_directory(options, index), recording_budget(options)},
+        transmitter{control_thread.context()},
+        datagram_transmitter{control_thread.context()},
+        channel{options.motor_channel},
+        motor_link{control_thread.context(),
+                   transmitter,
+                   datagram_transmitter,
+                   options.motor_channel,
+                   recorder,
+                   std::chrono::duration_cast<clock::duration>(
+                       std::chrono::duration<double>{1 / options.motor_rate}),
+                   options.motor_heartbeat},
+        ui{name(index, options.vehicles), index, sensor_data} {
+    ui.set_motor_channel(channel);
+    const size_t capacity = frame_capacity(options);
+    for (int i = 0; i < options.video_streams; ++i) {
+      video_streams.push_back(std::make_unique<VideoStream>(
+          i, video_thread.context(), gui_ctx, options, capacity, decode_pool,
+          recorder));
+      ui.add_camera(options.video_streams == 1
+                        ? "Camera View"
+                        : "Camera View " + std::to_string(i + 1),
+                    video_streams.back()->view());
+    }
+    ui.set_memory(options.vehicle_memory, capacity);
+  }
+  VehicleSession(const VehicleSession &) = delete;
+  VehicleSession &operator=(const VehicleSession &) = delete;
+
+  void set_thread_layout(std::vector<std::string> layout) {
+    ui.set_thread_layout(std::move(layout));
+  }
+
+  // Connects the control channel, video and sensor datagrams are taken from
+  // the address it connects to.
+  void connect(std::string_view host, std::string_view service) {
+    set_address(std::nullopt);
+    auto on_connect = [this](asio::error_code ec, const auto &endpoint) {
+      if (ec) {
+        set_address(std::nullopt);
+        return;
+      }
+      set_address(Address{endpoint});
+      connection.fetch_add(1, std::memory_order_relaxed);
+      motor_link.on_connected();
+    };
+    if (channel == MotorLink::Channel::Udp)
+      datagram_transmitter.async_connect(host, service, on_connect);
+    else
+      transmitter.async_connect(host, service, on_connect);
+  }
+
+  // On the receiving threads: whether the vehicle is connected from ip,
+  // IPv4 or IPv6. Behind a NAT several vehicles are.
+  bool sends_from(const asio::ip::address &ip) {
+    std::lock_guard lock{address_mutex};
+    return address && address->ip == unmapped(ip);
+  }
+  // counts up with every connection made
+  uint32_t connection_count() const {
+    return connection.load(std::memory_order_relaxed);
+  }
+  VideoStream &video_stream(size_t stream) { return *video_streams[stream]; }
+  void on_sensor_samples(std::span<const SensorSample> samples) {
+    recorder.record_sensor_samples(samples);
+    sensor_data.add_samples(samples);
+  }
+
+  // On the GUI thread: when the next frame of a shown stream is due.
+  clock::time_point next_frame_time() {
+    auto time = clock::time_point::max();
+    for (const auto &stream : video_streams)
+      time = std::min(time, stream->next_frame_time());
+    return time;
+  }
+  // Decodes the frames that are due if decode is set and picks up the
+  // statistics, returns whether there is anything new to draw.
+  bool update(bool decode) {
+    bool updated = false;
+    for (size_t i = 0; i < video_streams.size(); ++i) {
+      auto &stream = *video_streams[i];
+      stream.set_shown(ui.camera_visible(i));
+      if (decode)
+        updated |= stream.update();
+      if (auto stats = stream.take_stats())
+        ui.set_frame_stats(i, *stats);
+      ui.set_camera_image_size(i, stream.image_width(), stream.image_height());
+    }
+    if (auto stats = motor_link.take_stats())
+      ui.set_motor_stats(*stats);
+    {
+      std::lock_guard lock{address_mutex};
+      ui.set_address(address);
+    }
+    return updated;
+  }
+  // Draws the windows of the vehicle and sends the changes made in them.
+  void draw(int &driven_vehicle) {
+    ui.update(
+        motor_data,
+        [this](std::string_view host, std::string_view service) {
+          connect(host, service);
+        },
+        driven_vehicle);
+    motor_link.set(motor_data);
+  }
+  // the gamepad's input, sent right away
+  void drive(float left_speed, float right_speed) {
+    motor_data.left_speed = left_speed;
+    motor_data.right_speed = right_speed;
+    motor_link.set(motor_data);
+  }
+};
+
+#endif
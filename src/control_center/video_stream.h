@@ -0,0 +1,153 @@
+#ifndef VIDEO_STREAM_H
+#define VIDEO_STREAM_H
+
+#include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <span>
+
+#include "address.h"
+#include "frame_reassembler.h"
+#include "frame_stats.h"
+#include "gui_context.h"
+#include "options.h"
+#include "receiver_reporter.h"
+#include "session_recorder.h"
+#include "stream_stats.h"
+#include "texture_update_data.h"
+#include "worker_pool.h"
+
+// One camera of a vehicle, from the datagrams it sends to the texture it is
+// shown in. All streams are received on the same thread and decoded with the
+// same pool, everything else is their own. A stream that isn't shown is
+// still received, reassembled and reported on, but not decoded. Its frames
+// pile up in the playout buffer, which only keeps the newest ones, and the
+// newest due frame is decoded once the stream is shown again.
+class VideoStream {
+public:
+  static constexpr size_t width = 1280, height = 720;
+  // compressed frames of frame_capacity bytes that are held at once
+  static constexpr size_t frame_buffers =
+      FrameReassembler::slot_count + PlayoutBuffer::capacity + 1;
+
+  // Bytes taken besides the frame buffers: the texture, and the planes the
+  // decoder keeps at worst.
+  static size_t fixed_memory(PixelFormat format) {
+    const size_t texture = format == PixelFormat::YUV ? width * height * 3 / 2
+                                                      : width * height * 4;
+    return texture + width * height * 3;
+  }
+
+private:
+  using udp = asio::ip::udp;
+
+  const int index;
+  GUIContext &gui_ctx;
+  SessionRecorder &recorder;
+  Texture texture;
+  TextureUpdateData update_data;
+  FrameReassembler reassembler{update_data.frame_capacity()};
+  StreamStats stats;
+  ReceiverReporter reporter;
+  asio::steady_timer stats_timer;
+  std::atomic<bool> shown{true};
+  udp::endpoint sender; // of the last datagram, receiving thread only
+
+  // Frame ids start over when the sender restarts, and may when another one
+  // takes over, its frames would all be dropped as reordered otherwise.
+  void start_over() {
+    reassembler.reset();
+    update_data.reset_playout();
+    stats.restart();
+  }
+
+  // so that the statistics show a stream that stopped
+  void tick_stats() {
+    stats_timer.expires_after(stats.publish_period());
+    stats_timer.async_wait([this](asio::error_code ec) {
+      if (ec)
+        return;
+      stats.on_tick();
+      tick_stats();
+    });
+  }
+
+public:
+  VideoStream(int index, asio::io_context &ctx, GUIContext &gui_ctx,
+              const Options &options, size_t frame_capacity,
+              WorkerPool &decode_pool, SessionRecorder &recorder)
+      : index{index}, gui_ctx{gui_ctx}, recorder{recorder},
+        texture{gui_ctx.create_texture(width, height, options.video_format)},
+        update_data{texture, options.playout_mode, options.chroma_filter,
+                    frame_capacity, decode_pool},
+        reporter{ctx, index}, stats_timer{ctx} {
+    tick_stats();
+  }
+  VideoStream(const VideoStream &) = delete;
+  VideoStream &operator=(const VideoStream &) = delete;
+
+  // On the receiving thread, the payload goes straight into its frame.
+  void on_datagram(std::span<const unsigned char> datagram,
+                   const udp::endpoint &from) {
+    if (from != sender) {
+      sender = from;
+      reporter.set_sender(unmapped(from.address()));
+      start_over();
+    } else if (reassembler.starts_over(datagram)) {
+      start_over();
+    }
+    stats.on_datagram(datagram.size());
+    const auto status = reassembler.receive_fragment(
+        datagram,
+        [this](CompressedImage &frame, const FragmentHeader &header) {
+          recorder.record_frame(frame, header, index);
+          update_data.submit_frame(frame, header);
+          if (shown.load(std::memory_order_relaxed))
+            gui_ctx.wake();
+        });
+    const auto &header = reassembler.fragment_header();
+    if (status == FragmentStatus::Completed)
+      stats.on_frame(header.frame_id, header.frame_size);
+    else if (status == FragmentStatus::Duplicate)
+      stats.on_duplicate(header.frame_id);
+    else if (status == FragmentStatus::Reordered)
+      stats.on_reordered(header.frame_id);
+  }
+
+  const Texture &view() const { return texture; }
+
+  // from the GUI thread, whether the stream was visible in the last frame
+  void set_shown(bool value) { shown.store(value, std::memory_order_relaxed); }
+
+  // Decodes the frame that is due, if the stream is shown, and returns
+  // whether it did.
+  bool update() {
+    return shown.load(std::memory_order_relaxed) && update_data.update();
+  }
+  // when update() has the next frame to decode, max() if none is queued
+  std::chrono::steady_clock::time_point next_frame_time() {
+    if (!shown.load(std::memory_order_relaxed))
+      return std::chrono::steady_clock::time_point::max();
+    return update_data.next_frame_time();
+  }
+
+  // Returns the latest statistics if they haven't been taken yet, and sends
+  // them to the sender.
+  std::optional<FrameStats> take_stats() {
+    auto snapshot = stats.take();
+    if (!snapshot)
+      return std::nullopt;
+    snapshot->decode_time = update_data.frame_decode_time();
+    snapshot->playout_delay = update_data.playout_delay();
+    snapshot->frames_skipped = update_data.skipped_frames();
+    reporter.send(*snapshot, update_data.queued_frames());
+    return snapshot;
+  }
+
+  // part of the texture the last frame was decoded into
+  size_t image_width() const { return update_data.image_width(); }
+  size_t image_height() const { return update_data.image_height(); }
+};
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// A fixed set of threads that help the calling thread run the iterations of
+// a parallel_for. Only one thread may call parallel_for at a time.
+class WorkerPool {
+private:
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable work_available;
+  std::condition_variable work_done;
+
+  // type erased job, so that posting it doesn't allocate
+  void (*run_job)(const void *, size_t) = nullptr;
+  const void *job = nullptr;
+  size_t job_count{0};
+  size_t next_job{0};
+  size_t jobs_pending{0};
+  bool stopping{false};
+
+  void work() {
+    std::unique_lock lock{mutex};
+    while (true) {
+      work_available.wait(lock,
+                          [this] { return stopping || next_job < job_count; });
+      if (stopping)
+        return;
+      const size_t idx = next_job++;
+      lock.unlock();
+      run_job(job, idx);
+      lock.lock();
+      if (--jobs_pending == 0)
+        work_done.notify_all();
+    }
+  }
+
+public:
+  WorkerPool(size_t thread_count) {
+    for (size_t i = 0; i < thread_count; ++i)
+      workers.emplace_back([this] { work(); });
+  }
+  ~WorkerPool() {
+    {
+      std::lock_guard lock{mutex};
+      stopping = true;
+    }
+    work_available.notify_all();
+    for (auto &worker : workers)
+      worker.join();
+  }
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  // number of threads taking part in a parallel_for, including the caller
+  size_t concurrency() const { return workers.size() + 1; }
+
+  template <typename F> void parallel_for(size_t count, F &&f) {
+    std::unique_lock lock{mutex};
+    run_job = [](const void *job, size_t idx) {
+      (*static_cast<const std::remove_reference_t<F> *>(job))(idx);
+    };
+    job = &f;
+    job_count = count;
+    next_job = 0;
+    jobs_pending = count;
+    work_available.notify_all();
+
+    while (next_job < job_count) {
+      const size_t idx = next_job++;
+      lock.unlock();
+      f(idx);
+      lock.lock();
+      --jobs_pending;
+    }
+    work_done.wait(lock, [this] { return jobs_pending == 0; });
+    job_count = 0;
+    next_job = 0;
+  }
+};
+
+#endif
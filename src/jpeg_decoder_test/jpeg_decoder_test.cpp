@@ -0,0 +1,298 @@
+// Checks of JpegDecoder that the control center relies on:
+// - frames with malformed Huffman tables are turned down without writing
+//   outside the tables, and good frames decode the same before and after;
+// - once the first frames of a stream are through, decoding doesn't touch
+//   the heap, counted by replacing operator new;
+// - frames decode to within a few levels of what jpgd makes of them, in the
+//   sampling formats and sizes the encoder emits, with and without restart
+//   markers.
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <jpgd.h>
+
+#include "jpeg_decoder.h"
+#include "jpeg_encoder.h"
+#include "jpeg_layout.h"
+
+namespace {
+
+std::atomic<size_t> heap_allocations{0};
+
+constexpr size_t width = 320, height = 240;
+
+// a gradient with a checkerboard on top, so that blocks have some detail
+ImageStorage test_image(size_t image_width, size_t image_height) {
+  ImageStorage image{image_width, image_height};
+  for (size_t y = 0; y < image_height; ++y)
+    for (size_t x = 0; x < image_width; ++x) {
+      const unsigned char check = (x / 4 + y / 4) % 2 * 32;
+      image.data[y * image_width + x] = {
+          static_cast<unsigned char>(x + check),
+          static_cast<unsigned char>(y),
+          static_cast<unsigned char>(x + y - check)};
+    }
+  return image;
+}
+
+std::vector<unsigned char> encode(const ImageStorage &image,
+                                  jpge::subsampling_t subsampling,
+                                  size_t restart_rows) {
+  ImageCompressedStorage compressed{image.width, image.height};
+  compressed.stored_size = compressed.capacity;
+  jpge::params params;
+  params.m_quality = 80;
+  params.m_subsampling = subsampling;
+  const bool encoded =
+      restart_rows
+          ? compress_image_with_restarts(compressed, image, params,
+                                         restart_rows)
+          : jpge::compress_image_to_jpeg_file_in_memory(
+                compressed.data.get(), compressed.stored_size, image.width,
+                image.height, 3,
+                reinterpret_cast<const jpge::uint8 *>(image.data.get()),
+                params);
+  if (!encoded)
+    return {};
+  const auto *data = reinterpret_cast<unsigned char *>(compressed.data.get());
+  return {data, data + compressed.stored_size};
+}
+
+std::vector<unsigned char> encode_gradient(size_t restart_rows) {
+  return encode(test_image(width, height), jpge::H2V2, restart_rows);
+}
+
+// offsets of the Huffman tables in the frame's DHT segments
+std::vector<size_t> huffman_tables(const std::vector<unsigned char> &jpeg) {
+  std::vector<size_t> tables;
+  for (size_t pos = 2; pos + 4 < jpeg.size() && jpeg[pos + 1] != 0xDA;) {
+    const size_t end = pos + 2 + read_u16_be(&jpeg[pos + 2]);
+    if (jpeg[pos + 1] == 0xC4)
+      for (size_t table = pos + 4; table + 17 <= end;) {
+        tables.push_back(table);
+        table += 17 + std::accumulate(&jpeg[table + 1], &jpeg[table + 17], 0);
+      }
+    pos = end;
+  }
+  return tables;
+}
+
+bool decode(JpegDecoder &decoder, const std::vector<unsigned char> &jpeg,
+            std::vector<unsigned char> &pixels) {
+  std::fill(pixels.begin(), pixels.end(), 0);
+  return decoder.prepare(jpeg, width, height) &&
+         decoder.decode(pixels.data(), width * 4);
+}
+
+int check_malformed_tables(JpegDecoder &decoder,
+                           const std::vector<unsigned char> &jpeg) {
+  std::vector<unsigned char> expected(width * height * 4), pixels(
+                                                               expected.size());
+  if (!decode(decoder, jpeg, expected)) {
+    std::cerr << "Could not decode the test frame\n";
+    return 1;
+  }
+  int failures = 0;
+  for (const size_t table : huffman_tables(jpeg)) {
+    const unsigned char *counts = &jpeg[table + 1];
+    const int value_count = std::accumulate(counts, counts + 16, 0);
+    // The value count stays the same, so that only the code lengths are
+    // wrong.
+    struct Case {
+      const char *name;
+      std::vector<std::pair<int, int>> counts; // code length, codes
+    } cases[] = {
+        {"all codes of length 1", {{1, value_count}}},
+        {"codes of length 3 after a full length 2",
+         {{2, 4}, {3, value_count - 4}}},
+    };
+    for (const auto &c : cases) {
+      auto malformed = jpeg;
+      std::fill_n(&malformed[table + 1], 16, 0);
+      for (const auto &[length, count] : c.counts)
+        malformed[table + length] = count;
+      if (decode(decoder, malformed, pixels)) {
+        std::cerr << "Table " << (jpeg[table] >> 4 ? "AC" : "DC")
+                  << (jpeg[table] & 0x0F) << ", " << c.name
+                  << ": decoded a malformed table\n";
+        ++failures;
+      }
+      if (!decode(decoder, jpeg, pixels) || pixels != expected) {
+        std::cerr << "Table " << (jpeg[table] >> 4 ? "AC" : "DC")
+                  << (jpeg[table] & 0x0F) << ", " << c.name
+                  << ": the good frame decodes differently after\n";
+        ++failures;
+      }
+    }
+  }
+  return failures;
+}
+
+int check_steady_state_allocations(JpegDecoder &decoder,
+                                   const std::vector<unsigned char> &jpeg) {
+  std::vector<unsigned char> pixels(width * height * 4);
+  // the first frames size the decoder's buffers
+  for (int i = 0; i < 2; ++i)
+    if (!decode(decoder, jpeg, pixels) || !decoder.decode()) {
+      std::cerr << "Could not decode the test frame\n";
+      return 1;
+    }
+  const size_t before = heap_allocations.load();
+  for (int i = 0; i < 20; ++i) {
+    decode(decoder, jpeg, pixels);
+    decoder.prepare(jpeg, width, height);
+    decoder.decode();
+  }
+  const size_t allocations = heap_allocations.load() - before;
+  if (allocations == 0)
+    return 0;
+  std::cerr << allocations << " heap allocations in 20 steady state frames\n";
+  return 1;
+}
+
+// RGBA rows of jpeg as jpgd decodes them, empty if it can't
+std::vector<unsigned char> decode_with_jpgd(
+    const std::vector<unsigned char> &jpeg, JpegDecoder::ChromaFilter filter) {
+  jpgd::jpeg_decoder_mem_stream stream{jpeg.data(),
+                                       static_cast<jpgd::uint>(jpeg.size())};
+  jpgd::jpeg_decoder decoder{
+      &stream, filter == JpegDecoder::ChromaFilter::Nearest
+                   ? jpgd::jpeg_decoder::cFlagBoxChromaFiltering
+                   : 0u};
+  if (decoder.get_error_code() != jpgd::JPGD_SUCCESS ||
+      decoder.begin_decoding() != jpgd::JPGD_SUCCESS)
+    return {};
+  const size_t image_width = decoder.get_width();
+  const bool grayscale = decoder.get_bytes_per_pixel() == 1;
+  std::vector<unsigned char> pixels(image_width * decoder.get_height() * 4);
+  for (auto out = pixels.begin(); out != pixels.end();) {
+    const void *scan_line;
+    jpgd::uint scan_line_len;
+    if (decoder.decode(&scan_line, &scan_line_len) != jpgd::JPGD_SUCCESS)
+      return {};
+    const auto *in = static_cast<const unsigned char *>(scan_line);
+    for (size_t x = 0; x < image_width; ++x, out += 4) {
+      if (grayscale) {
+        std::fill_n(out, 3, in[x]);
+        out[3] = 255;
+      } else {
+        std::copy_n(in + x * 4, 4, out);
+      }
+    }
+  }
+  return pixels;
+}
+
+// Decodes jpeg with decoder and with jpgd and compares the pixels. The IDCTs
+// round differently, and the chroma filters differ at the edges, so single
+// levels may be off by a few.
+int check_reference(JpegDecoder &decoder,
+                    const std::vector<unsigned char> &jpeg,
+                    JpegDecoder::ChromaFilter filter,
+                    const std::string &name) {
+  const auto expected = decode_with_jpgd(jpeg, filter);
+  const auto layout = parse_jpeg_layout(jpeg);
+  if (expected.empty() || !layout) {
+    std::cerr << name << ": jpgd could not decode the test frame\n";
+    return 1;
+  }
+  std::vector<unsigned char> pixels(expected.size());
+  if (!decoder.prepare(jpeg, layout->width, layout->height) ||
+      !decoder.decode(pixels.data(), layout->width * 4)) {
+    std::cerr << name << ": could not decode the test frame\n";
+    return 1;
+  }
+  constexpr int max_difference = 8;
+  constexpr double max_mean_difference = 1;
+  int worst = 0;
+  double total = 0;
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    const int difference = std::abs(pixels[i] - expected[i]);
+    worst = std::max(worst, difference);
+    total += difference;
+  }
+  const double mean = total / pixels.size();
+  if (worst <= max_difference && mean <= max_mean_difference)
+    return 0;
+  std::cerr << name << ": differs from jpgd by up to " << worst
+            << " levels, " << mean << " on average\n";
+  return 1;
+}
+
+int check_references(WorkerPool &pool) {
+  struct Format {
+    const char *name;
+    jpge::subsampling_t subsampling;
+  } formats[] = {{"4:2:0", jpge::H2V2}, {"4:4:4", jpge::H1V1},
+                 {"grayscale", jpge::Y_ONLY}};
+  struct Size {
+    size_t width, height;
+  } sizes[] = {{width, height}, {317, 211}};
+  int failures = 0;
+  for (const auto &format : formats)
+    for (const auto &size : sizes)
+      for (const size_t restart_rows : {0, 1, 3}) {
+        const auto jpeg = encode(test_image(size.width, size.height),
+                                 format.subsampling, restart_rows);
+        const std::string name =
+            std::string{format.name} + " " + std::to_string(size.width) +
+            "x" + std::to_string(size.height) + ", restarts every " +
+            std::to_string(restart_rows) + " rows";
+        if (jpeg.empty()) {
+          std::cerr << name << ": could not encode the test frame\n";
+          ++failures;
+          continue;
+        }
+        for (const auto filter : {JpegDecoder::ChromaFilter::Nearest,
+                                  JpegDecoder::ChromaFilter::Linear}) {
+          JpegDecoder decoder{pool, filter};
+          failures += check_reference(
+              decoder, jpeg, filter,
+              name + (filter == JpegDecoder::ChromaFilter::Nearest
+                          ? ", nearest chroma"
+                          : ", linear chroma"));
+        }
+      }
+  return failures;
+}
+
+} // namespace
+
+void *operator new(size_t size) {
+  heap_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc{};
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+int main() {
+  // several bands, and a single one without restart markers
+  const auto banded = encode_gradient(1);
+  const auto whole = encode_gradient(0);
+  if (banded.empty() || whole.empty()) {
+    std::cerr << "Could not encode the test frames\n";
+    return 1;
+  }
+
+  WorkerPool pool{3};
+  int failures = 0;
+  for (const auto *jpeg : {&banded, &whole}) {
+    for (const auto filter : {JpegDecoder::ChromaFilter::Nearest,
+                              JpegDecoder::ChromaFilter::Linear}) {
+      JpegDecoder decoder{pool, filter};
+      failures += check_malformed_tables(decoder, *jpeg);
+      failures += check_steady_state_allocations(decoder, *jpeg);
+    }
+  }
+  failures += check_references(pool);
+  return failures ? 1 : 0;
+}
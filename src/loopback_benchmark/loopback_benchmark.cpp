@@ -0,0 +1,384 @@
+#include <algorithm>
+#include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "frame_fragmenter.h"
+#include "frame_reassembler.h"
+#include "jpeg_decoder.h"
+#include "jpeg_encoder.h"
+#include "playout_buffer.h"
+#include "receiving_loop.h"
+#include "worker_pool.h"
+
+// Runs the video path of test_driver and control_center in one process over
+// loopback: synthetic frames are encoded and fragmented like test_driver
+// does, and received, reassembled, queued and decoded like control_center
+// does. Only the texture upload is left out, it needs a window. Every frame
+// is timed at each stage and the results are printed as JSON. With several
+// streams every one has a sender thread of its own, like a test_driver
+// instance per camera, and they are all received on one thread and decoded
+// one after the other with a shared pool, like control_center does.
+
+using udp = asio::ip::udp;
+using clock_type = std::chrono::steady_clock;
+
+struct Options {
+  size_t width = 1280, height = 720;
+  int quality = 50;
+  size_t restart_rows = 4;
+  double fps = 30;
+  size_t frames = 600;
+  size_t receive_batch = 32;
+  size_t streams = 1;
+};
+
+Options parse_options(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (i + 1 == argc)
+      throw std::runtime_error("Missing value for " + std::string(arg));
+    const char *value = argv[++i];
+    if (arg == "--width")
+      options.width = std::stoul(value);
+    else if (arg == "--height")
+      options.height = std::stoul(value);
+    else if (arg == "--quality")
+      options.quality = std::stoi(value);
+    else if (arg == "--restart-rows")
+      options.restart_rows = std::stoul(value);
+    else if (arg == "--fps")
+      options.fps = std::stod(value);
+    else if (arg == "--frames")
+      options.frames = std::stoul(value);
+    else if (arg == "--receive-batch")
+      options.receive_batch = std::max<size_t>(std::stoul(value), 1);
+    else if (arg == "--streams")
+      options.streams = std::max<size_t>(std::stoul(value), 1);
+    else
+      throw std::runtime_error("Unknown option " + std::string(arg));
+  }
+  if (options.fps <= 0 || options.frames == 0)
+    throw std::runtime_error("fps and frames have to be positive");
+  return options;
+}
+
+// A gradient that moves from frame to frame under some noise, which
+// compresses about as well as a camera image.
+ImageStorage synthetic_frame(size_t width, size_t height, size_t index) {
+  ImageStorage image{width, height};
+  uint32_t state = 12345 + index;
+  for (size_t y = 0; y < height; ++y) {
+    for (size_t x = 0; x < width; ++x) {
+      state = state * 1664525 + 1013904223;
+      const auto noise = static_cast<unsigned char>(state >> 28);
+      image.data[y * width + x] = {
+          static_cast<unsigned char>((x + index * 4) / 5 + noise),
+          static_cast<unsigned char>((y + index * 2) / 3 + noise),
+          static_cast<unsigned char>((x + y) / 8 + noise)};
+    }
+  }
+  return image;
+}
+
+// CPU time used by the calling thread
+clock_type::duration thread_cpu_time() {
+  timespec time;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+  return std::chrono::seconds{time.tv_sec} +
+         std::chrono::nanoseconds{time.tv_nsec};
+}
+clock_type::duration process_cpu_time() {
+  timespec time;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+  return std::chrono::seconds{time.tv_sec} +
+         std::chrono::nanoseconds{time.tv_nsec};
+}
+
+// Every field is written by one thread, they are read once all are joined.
+struct FrameTimes {
+  clock_type::time_point captured, encoded, sent, received, taken, decoded;
+  size_t size = 0;
+};
+
+class Stage {
+  const char *name;
+  std::vector<double> samples; // in milliseconds
+
+public:
+  Stage(const char *name) : name{name} {}
+  void add(clock_type::duration duration) {
+    samples.push_back(
+        std::chrono::duration<double, std::milli>(duration).count());
+  }
+  void print(std::ostream &out) {
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&](double p) {
+      if (samples.empty())
+        return 0.0;
+      return samples[static_cast<size_t>(p * (samples.size() - 1) + 0.5)];
+    };
+    out << '"' << name << "\": {\"p50\": " << percentile(0.5)
+        << ", \"p90\": " << percentile(0.9)
+        << ", \"p99\": " << percentile(0.99)
+        << ", \"max\": " << percentile(1) << '}';
+  }
+};
+
+// What one camera goes through on the receiving side.
+struct Stream {
+  std::vector<FrameTimes> times;
+  FrameReassembler reassembler;
+  PlayoutBuffer playout;
+  JpegDecoder decoder;
+  CompressedImage current;
+  std::vector<unsigned char> pixels;
+  udp::endpoint endpoint; // the receiving socket's
+  size_t decode_failures = 0;
+  clock_type::duration sender_cpu{};
+
+  Stream(const Options &options, size_t frame_capacity,
+         WorkerPool &decode_pool)
+      : times(options.frames), reassembler{frame_capacity},
+        playout{PlayoutBuffer::Mode::ZeroDepth, frame_capacity},
+        decoder{decode_pool},
+        current{std::make_unique<unsigned char[]>(frame_capacity), 0},
+        pixels(options.width * options.height * 4) {}
+
+  void on_datagram(asio::error_code ec,
+                   std::span<const unsigned char> datagram) {
+    if (ec)
+      return;
+    reassembler.receive_fragment(
+        datagram,
+        [this](CompressedImage &frame, const FragmentHeader &header) {
+          if (header.frame_id < times.size())
+            times[header.frame_id].received = clock_type::now();
+          playout.submit(frame, header.frame_id, header.capture_time_us);
+        });
+  }
+  // Decodes the frame that is due, returns false if there is none.
+  bool decode(const Options &options) {
+    const auto id = playout.take(current);
+    if (!id)
+      return false;
+    auto &frame = times[*id];
+    frame.taken = clock_type::now();
+    if (decoder.prepare({current.data.get(), current.size}, options.width,
+                        options.height) &&
+        decoder.decode(pixels.data(), options.width * 4))
+      frame.decoded = clock_type::now();
+    else
+      ++decode_failures;
+    return true;
+  }
+};
+struct OnDatagram {
+  Stream *stream;
+  void operator()(asio::error_code ec, std::span<const unsigned char> datagram,
+                  const udp::endpoint &) const {
+    stream->on_datagram(ec, datagram);
+  }
+};
+
+// Encodes and sends the frames of one stream at the target rate.
+void send_stream(Stream &stream, const Options &options,
+                 const std::vector<ImageStorage> &sources) {
+  asio::io_context send_ctx;
+  udp::socket socket{send_ctx};
+  socket.open(udp::v4());
+  socket.connect(stream.endpoint);
+  ImageCompressedStorage compressed;
+  FrameFragmenter fragmenter;
+  const auto interval = std::chrono::duration_cast<clock_type::duration>(
+      std::chrono::duration<double>{1 / options.fps});
+  auto next = clock_type::now();
+  for (uint32_t id = 0; id < options.frames; ++id, next += interval) {
+    std::this_thread::sleep_until(next);
+    auto &frame = stream.times[id];
+    frame.captured = clock_type::now();
+    if (!compress_image(compressed, sources[id % sources.size()],
+                        options.quality, options.restart_rows)) {
+      std::cerr << "Could not compress frame\n";
+      continue;
+    }
+    frame.encoded = clock_type::now();
+    frame.size = compressed.stored_size;
+    fragmenter.reset(id,
+                     std::chrono::duration_cast<std::chrono::microseconds>(
+                         frame.captured.time_since_epoch())
+                         .count(),
+                     compressed.data.get(), compressed.stored_size);
+    while (!fragmenter.done())
+      socket.send(fragmenter.next_fragment());
+    frame.sent = clock_type::now();
+  }
+  stream.sender_cpu = thread_cpu_time();
+}
+
+// use with
+// ./loopback_benchmark [--width N] [--height N] [--quality N]
+// [--restart-rows N] [--fps X] [--frames N] [--receive-batch N]
+// [--streams N]
+int main(int argc, char **argv) {
+  try {
+    const Options options = parse_options(argc, argv);
+    std::vector<ImageStorage> sources;
+    for (size_t i = 0; i < 8; ++i)
+      sources.push_back(synthetic_frame(options.width, options.height, i));
+    const auto cpu_start = process_cpu_time();
+
+    // receiving side, as in control_center
+    WorkerPool decode_pool{
+        std::max(std::thread::hardware_concurrency(), 1u) - 1};
+    const size_t frame_capacity = options.width * options.height * 3;
+    asio::io_context ctx;
+    std::vector<std::unique_ptr<Stream>> streams;
+    std::vector<std::unique_ptr<ReceivingLoop<OnDatagram>>> receiving_loops;
+    for (size_t i = 0; i < options.streams; ++i) {
+      auto &stream = *streams.emplace_back(
+          std::make_unique<Stream>(options, frame_capacity, decode_pool));
+      udp::socket socket{ctx,
+                         udp::endpoint{asio::ip::address_v4::loopback(), 0}};
+      stream.endpoint = socket.local_endpoint();
+      receiving_loops.push_back(
+          std::make_unique<ReceivingLoop<OnDatagram>>(
+              std::move(socket), MAX_VIDEO_DATAGRAM_SZ, OnDatagram{&stream},
+              options.receive_batch, 4 * 1024 * 1024));
+    }
+    clock_type::duration receiver_cpu{};
+    std::thread receiver{[&] {
+      ctx.run();
+      receiver_cpu = thread_cpu_time();
+    }};
+
+    // sending side, a test_driver per stream
+    std::atomic<size_t> sending{options.streams};
+    std::vector<std::thread> senders;
+    for (auto &stream : streams)
+      senders.emplace_back([&, &stream = *stream] {
+        send_stream(stream, options, sources);
+        --sending;
+      });
+
+    // decoding, as the GUI thread of control_center does
+    const auto decoder_cpu_start = thread_cpu_time();
+    {
+      // waits for stragglers a bit after the last frame was sent
+      auto idle_since = clock_type::now();
+      while (clock_type::now() - idle_since < std::chrono::milliseconds{200}) {
+        if (sending)
+          idle_since = clock_type::now();
+        bool decoded = false;
+        for (auto &stream : streams)
+          decoded |= stream->decode(options);
+        if (decoded)
+          idle_since = clock_type::now();
+        else
+          std::this_thread::sleep_for(std::chrono::microseconds{100});
+      }
+    }
+    const auto decoder_cpu = thread_cpu_time() - decoder_cpu_start;
+    const auto total_cpu = process_cpu_time() - cpu_start;
+    ctx.stop();
+    for (auto &sender : senders)
+      sender.join();
+    receiver.join();
+
+    Stage encode{"encode"}, transmit{"transmit"}, queue{"queue"},
+        decode{"decode"}, total{"total"};
+    size_t sent = 0, received = 0, decoded = 0, bytes = 0,
+           decode_failures = 0;
+    clock_type::duration sender_cpu{};
+    double fps = 0; // of all streams together
+    std::vector<double> stream_fps;
+    for (const auto &stream : streams) {
+      size_t stream_decoded = 0;
+      clock_type::time_point first_decoded = clock_type::time_point::max(),
+                             last_decoded{};
+      for (const auto &frame : stream->times) {
+        if (frame.encoded == clock_type::time_point{})
+          continue; // couldn't be compressed, never sent
+        ++sent;
+        encode.add(frame.encoded - frame.captured);
+        bytes += frame.size;
+        if (frame.received == clock_type::time_point{})
+          continue;
+        ++received;
+        transmit.add(frame.received - frame.encoded);
+        if (frame.decoded == clock_type::time_point{})
+          continue;
+        ++stream_decoded;
+        queue.add(frame.taken - frame.received);
+        decode.add(frame.decoded - frame.taken);
+        total.add(frame.decoded - frame.captured);
+        first_decoded = std::min(first_decoded, frame.decoded);
+        last_decoded = std::max(last_decoded, frame.decoded);
+      }
+      const double seconds =
+          stream_decoded > 1
+              ? std::chrono::duration<double>(last_decoded - first_decoded)
+                    .count()
+              : 0;
+      stream_fps.push_back(seconds > 0 ? (stream_decoded - 1) / seconds : 0);
+      fps += stream_fps.back();
+      decoded += stream_decoded;
+      decode_failures += stream->decode_failures;
+      sender_cpu += stream->sender_cpu;
+    }
+    auto per_frame_ms = [&](clock_type::duration cpu) {
+      return decoded ? std::chrono::duration<double, std::milli>(cpu).count() /
+                           decoded
+                     : 0.0;
+    };
+
+    // transmit covers sending, the network and reassembly, queue the time
+    // spent in the playout buffer until the decoding thread takes the frame
+    auto &out = std::cout;
+    out << std::fixed << std::setprecision(3) << "{\"width\": "
+        << options.width << ", \"height\": " << options.height
+        << ", \"quality\": " << options.quality
+        << ", \"restart_rows\": " << options.restart_rows
+        << ", \"target_fps\": " << options.fps
+        << ", \"streams\": " << options.streams
+        << ", \"frames_sent\": " << sent
+        << ", \"frames_received\": " << received
+        << ", \"frames_decoded\": " << decoded
+        << ", \"decode_failures\": " << decode_failures
+        << ", \"mean_frame_bytes\": " << (sent ? bytes / sent : 0)
+        << ", \"fps\": " << fps << ", \"stream_fps\": [";
+    for (size_t i = 0; i < stream_fps.size(); ++i)
+      out << (i ? ", " : "") << stream_fps[i];
+    out << "], \"cpu_ms_per_frame\": {\"total\": " << per_frame_ms(total_cpu)
+        << ", \"sender\": " << per_frame_ms(sender_cpu)
+        << ", \"receiver\": " << per_frame_ms(receiver_cpu)
+        << ", \"decoder\": " << per_frame_ms(decoder_cpu)
+        << "}, \"latency_ms\": {";
+    encode.print(out);
+    out << ", ";
+    transmit.print(out);
+    out << ", ";
+    queue.print(out);
+    out << ", ";
+    decode.print(out);
+    out << ", ";
+    total.print(out);
+    out << "}}\n";
+  } catch (const std::exception &e) {
+    std::cerr << "BENCHMARK ERROR: " << e.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
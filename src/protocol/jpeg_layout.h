@@ -0,0 +1,113 @@
+#ifndef JPEG_LAYOUT_H
+#define JPEG_LAYOUT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+// Positions of the parts of a JPEG stream that are needed to split or stitch
+// it at restart interval boundaries without decoding it.
+struct JpegLayout {
+  bool baseline; // huffman coded sequential DCT in a single interleaved scan
+  size_t width, height;
+  size_t component_count;
+  size_t mcu_width, mcu_height;
+  size_t restart_interval;  // in MCUs, 0 if there are no restart markers
+  size_t sof_height_offset; // offset of the 16 bit image height
+  size_t sos_offset;        // offset of the start of scan marker
+  size_t scan_offset;       // offset of the entropy coded data
+};
+
+inline uint16_t read_u16_be(const unsigned char *p) {
+  return static_cast<uint16_t>(p[0] << 8 | p[1]);
+}
+
+inline void write_u16_be(unsigned char *p, uint16_t value) {
+  p[0] = static_cast<unsigned char>(value >> 8);
+  p[1] = static_cast<unsigned char>(value);
+}
+
+// Walks the headers up to the entropy coded data. If they run past the end
+// of jpeg, *truncated is set, so that a caller reading a stream can tell a
+// frame that isn't complete yet from a corrupt one.
+inline std::optional<JpegLayout>
+parse_jpeg_layout(std::span<const unsigned char> jpeg,
+                  bool *truncated = nullptr) {
+  if (truncated)
+    *truncated = false;
+  if (jpeg.size() < 2 || jpeg[0] != 0xFF || jpeg[1] != 0xD8)
+    return std::nullopt;
+
+  JpegLayout layout{};
+  bool has_frame = false;
+  size_t pos = 2;
+  while (pos + 4 <= jpeg.size()) {
+    if (jpeg[pos] != 0xFF)
+      return std::nullopt;
+    const unsigned char marker = jpeg[pos + 1];
+    if (marker == 0xFF) { // fill byte
+      ++pos;
+      continue;
+    }
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {
+      pos += 2; // markers without a segment
+      continue;
+    }
+    if (marker == 0xD9)
+      return std::nullopt;
+
+    const size_t length = read_u16_be(&jpeg[pos + 2]);
+    if (length < 2)
+      return std::nullopt;
+    if (pos + 2 + length > jpeg.size())
+      break;
+    const unsigned char *segment = &jpeg[pos + 4];
+    const size_t segment_size = length - 2;
+
+    const bool is_sof = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+                        marker != 0xC8 && marker != 0xCC;
+    if (is_sof) {
+      if (segment_size < 6)
+        return std::nullopt;
+      layout.component_count = segment[5];
+      if (segment_size < 6 + 3 * layout.component_count)
+        return std::nullopt;
+      layout.baseline = (marker == 0xC0 || marker == 0xC1) &&
+                        segment[0] == 8 && layout.component_count > 0;
+      layout.height = read_u16_be(segment + 1);
+      layout.width = read_u16_be(segment + 3);
+      layout.sof_height_offset = pos + 5;
+
+      size_t max_h = 1, max_v = 1;
+      for (size_t i = 0; i < layout.component_count; ++i) {
+        const unsigned char sampling = segment[6 + 3 * i + 1];
+        max_h = std::max<size_t>(max_h, sampling >> 4);
+        max_v = std::max<size_t>(max_v, sampling & 0x0F);
+      }
+      // a scan with a single component is never interleaved
+      layout.mcu_width = layout.component_count == 1 ? 8 : 8 * max_h;
+      layout.mcu_height = layout.component_count == 1 ? 8 : 8 * max_v;
+      has_frame = true;
+    } else if (marker == 0xDD) {
+      if (segment_size < 2)
+        return std::nullopt;
+      layout.restart_interval = read_u16_be(segment);
+    } else if (marker == 0xDA) {
+      if (!has_frame || segment_size < 1)
+        return std::nullopt;
+      if (segment[0] != layout.component_count || layout.height == 0)
+        layout.baseline = false;
+      layout.sos_offset = pos;
+      layout.scan_offset = pos + 2 + length;
+      return layout;
+    }
+    pos += 2 + length;
+  }
+  if (truncated)
+    *truncated = true;
+  return std::nullopt;
+}
+
+#endif
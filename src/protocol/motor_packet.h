@@ -0,0 +1,56 @@
+#ifndef MOTOR_PACKET_H
+#define MOTOR_PACKET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// The control center sends a command to the vehicle as soon as the input
+// changes, at most at a configured rate, and repeats the current one as a
+// heartbeat when the input doesn't change. The vehicle answers every command
+// with an acknowledgement that echoes its sequence number and send time, so
+// the control center can measure the round trip time without synchronized
+// clocks.
+//
+// Over TCP every command is sent on its own. Over UDP, to the port below,
+// every datagram repeats the previous commands after the latest one, so a
+// lost datagram doesn't lose the commands in it. The vehicle only applies
+// the newest command it has seen and acknowledges to the sender.
+constexpr int MOTOR_UDP_PORT = 1333;
+constexpr size_t MOTOR_REDUNDANCY = 4; // commands per datagram at most
+
+struct MotorCommand {
+  uint32_t sequence; // incremented with every command, heartbeats included
+  uint32_t reserved;
+  int64_t send_time_us; // steady clock of the control center
+  float left_speed;
+  float right_speed;
+};
+
+struct MotorAck {
+  uint32_t sequence; // of the command
+  uint32_t applied;  // 0 if a newer command had been applied already
+  int64_t send_time_us; // of the command, echoed
+  // commands that never arrived, neither on their own nor repeated
+  uint32_t lost;
+  uint32_t reserved;
+};
+
+struct MotorDatagram {
+  uint32_t count; // of commands, newest first with consecutive sequences
+  uint32_t reserved;
+  MotorCommand commands[MOTOR_REDUNDANCY];
+
+  size_t size() const { return 8 + count * sizeof(MotorCommand); }
+};
+
+// The commands in a received datagram, empty if it is malformed.
+inline std::span<const MotorCommand>
+motor_commands(const MotorDatagram &datagram, size_t bytes_received) {
+  if (bytes_received < 8 || datagram.count == 0 ||
+      datagram.count > MOTOR_REDUNDANCY || datagram.size() > bytes_received)
+    return {};
+  return {datagram.commands, datagram.count};
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef RECEIVER_REPORT_H
+#define RECEIVER_REPORT_H
+
+#include <cstdint>
+
+// The control center sends a report about a video stream to the port below
+// on the video sender about twice a second, the report about stream i to
+// report_port(i). The sender adapts its bitrate to them.
+constexpr int REPORT_UDP_PORT = 1513;
+constexpr uint16_t report_port(int stream) {
+  return REPORT_UDP_PORT + 2 * stream;
+}
+
+struct ReceiverReport {
+  uint32_t sequence;
+  uint32_t interval_us;     // time covered by the report
+  uint32_t frames_received; // in the interval
+  uint32_t frames_lost;     // in the interval
+  uint32_t bytes_per_second;
+  uint32_t queue_depth;   // frames waiting in the playout buffer
+  float fps;              // completed frames per second
+  float jitter_ms;        // of the time between frames
+  float decode_ms;        // time to decode and upload a frame
+  float playout_delay_ms; // time frames are held back for
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef SENSOR_PACKET_H
+#define SENSOR_PACKET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+enum class SensorType : uint32_t {
+  BEGIN = 1,
+  WaterTemperature = BEGIN,
+  WaterTurbidity,
+  Dust,
+  AtmosphericPressure,
+  AtmosphericTemperature,
+  AtmosphericHumidity,
+  BatteryVoltage,
+  END
+};
+
+// Sensor readings are sent in batches, every datagram holds a header and
+// sample_count samples. Each sensor is sampled at its own rate, so a batch
+// holds any mix of sensors, the samples of one sensor in the order they were
+// taken. Datagrams with another version are dropped by the receiver.
+constexpr uint16_t SENSOR_PROTOCOL_VERSION = 1;
+
+struct SensorBatchHeader {
+  uint16_t version;
+  uint16_t sample_count;
+  uint32_t sequence;
+};
+
+struct SensorSample {
+  uint64_t time_us; // on the sender's steady clock
+  SensorType sensor;
+  float value;
+};
+
+constexpr size_t MAX_SENSOR_DATAGRAM_SZ = 1472;
+constexpr size_t MAX_SENSOR_BATCH_SZ =
+    (MAX_SENSOR_DATAGRAM_SZ - sizeof(SensorBatchHeader)) / sizeof(SensorSample);
+
+struct SensorBatch {
+  SensorBatchHeader header;
+  SensorSample samples[MAX_SENSOR_BATCH_SZ];
+
+  size_t size() const {
+    return sizeof(header) + header.sample_count * sizeof(SensorSample);
+  }
+};
+
+// Returns the samples of a received batch, or none if it is malformed.
+inline std::span<const SensorSample>
+sensor_samples(const SensorBatch &batch, size_t bytes_received) {
+  if (bytes_received < sizeof(batch.header) ||
+      batch.header.version != SENSOR_PROTOCOL_VERSION ||
+      batch.header.sample_count > MAX_SENSOR_BATCH_SZ ||
+      batch.size() > bytes_received)
+    return {};
+  return {batch.samples, batch.header.sample_count};
+}
+// The same for a datagram in a buffer aligned for a SensorBatch.
+inline std::span<const SensorSample>
+sensor_samples(std::span<const unsigned char> datagram) {
+  return sensor_samples(*reinterpret_cast<const SensorBatch *>(datagram.data()),
+                        datagram.size());
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef VIDEO_PACKET_H
+#define VIDEO_PACKET_H
+
+#include <cstddef>
+#include <cstdint>
+
+// A compressed frame is split into fragments, each sent in its own datagram.
+// Every datagram starts with this header and carries the bytes
+// [offset, offset + payload size) of the frame.
+struct FragmentHeader {
+  uint32_t frame_id;
+  uint16_t fragment_index;
+  uint16_t fragment_count;
+  uint32_t offset;
+  uint32_t frame_size;
+  uint64_t capture_time_us; // on the sender's steady clock
+};
+
+// A vehicle with several cameras sends each of them as a stream of its own,
+// stream i to the port video_port(i). The ports tell the streams apart, the
+// datagrams don't say which stream they belong to.
+constexpr int VIDEO_UDP_PORT = 1512;
+constexpr int MAX_VIDEO_STREAMS = 4;
+// every other port, the ones in between take the receiver reports
+constexpr uint16_t video_port(int stream) {
+  return VIDEO_UDP_PORT + 2 * stream;
+}
+
+// Datagrams are kept below the Ethernet MTU so they don't get fragmented on
+// the IP level, where losing any piece drops the whole datagram.
+constexpr size_t MAX_VIDEO_DATAGRAM_SZ = 1472;
+constexpr size_t MAX_FRAGMENT_PAYLOAD_SZ =
+    MAX_VIDEO_DATAGRAM_SZ - sizeof(FragmentHeader);
+
+#endif
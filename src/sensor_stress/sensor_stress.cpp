@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "sensor_data.h"
+
+// Hammers SensorData from both of its sides at once: one thread adds samples
+// like the receiving thread of control_center does, another takes snapshots
+// and changes the view like its UI thread does. Every sample's value follows
+// from its time, so a snapshot that mixes two states or reads a half written
+// point fails the checks. Meant to be built with -fsanitize=thread, which
+// catches the races the checks can't see.
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct Options {
+  double seconds = 2;
+  size_t batch = 32; // samples of every sensor per batch
+};
+
+Options parse_options(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (i + 1 == argc)
+      throw std::runtime_error("Missing value for " + std::string(arg));
+    const char *value = argv[++i];
+    if (arg == "--seconds")
+      options.seconds = std::stod(value);
+    else if (arg == "--batch")
+      options.batch = std::max<size_t>(std::stoul(value), 1);
+    else
+      throw std::runtime_error("Unknown option " + std::string(arg));
+  }
+  return options;
+}
+
+// the value every sensor reads at time_us, differs from sensor to sensor
+float value_at(size_t sensor, int64_t time_us) {
+  return static_cast<float>((time_us / 1000 + sensor * 100) % 1000);
+}
+
+// Returns what is wrong with the snapshot, if anything. previous is the
+// latest time of every sensor in the last snapshot, which may not go back.
+std::string check(const SensorData::Snapshot &snapshot,
+                  std::vector<double> &previous) {
+  for (size_t i = 0; i < SensorData::sensor_count; ++i) {
+    const auto &sensor = snapshot.sensors[i];
+    if (sensor.empty)
+      continue;
+    const auto time_us = std::llround(sensor.latest_time * 1e6);
+    if (sensor.latest != value_at(i, time_us))
+      return "latest value doesn't match its time";
+    if (sensor.latest_time < previous[i])
+      return "latest time went back";
+    previous[i] = sensor.latest_time;
+    for (size_t j = 0; j < sensor.points.size(); ++j) {
+      const auto &point = sensor.points[j];
+      if (!(point.min <= point.mean && point.mean <= point.max) ||
+          point.min < 0 || point.max >= 1000)
+        return "point out of range";
+      if (j && point.time < sensor.points[j - 1].time)
+        return "points out of order";
+      if (point.time > sensor.latest_time + 60)
+        return "point after the latest sample";
+    }
+  }
+  return {};
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  try {
+    const Options options = parse_options(argc, argv);
+    const auto end =
+        clock_type::now() + std::chrono::duration_cast<clock_type::duration>(
+                                std::chrono::duration<double>{options.seconds});
+    SensorData data;
+    std::atomic<bool> done{false};
+    size_t batches = 0;
+
+    std::thread receiver{[&] {
+      std::vector<SensorSample> samples;
+      int64_t time_us = 0;
+      while (!done.load(std::memory_order_relaxed)) {
+        samples.clear();
+        for (size_t n = 0; n < options.batch; ++n, time_us += 10'000)
+          for (size_t i = 0; i < SensorData::sensor_count; ++i)
+            samples.push_back({static_cast<uint64_t>(time_us),
+                               static_cast<SensorType>(i + 1),
+                               value_at(i, time_us)});
+        data.add_samples(samples);
+        ++batches;
+      }
+    }};
+
+    size_t snapshots = 0, failures = 0;
+    std::vector<double> previous(SensorData::sensor_count, 0);
+    while (clock_type::now() < end) {
+      // the view changes as if the plot got resized now and then
+      data.set_view(snapshots % 64 < 32 ? 60 : 3600,
+                    64 + snapshots % 4 * 64);
+      const auto problem = check(data.snapshot(), previous);
+      if (!problem.empty() && failures++ < 10)
+        std::cerr << "Snapshot " << snapshots << ": " << problem << "\n";
+      ++snapshots;
+      std::this_thread::yield();
+    }
+    done = true;
+    receiver.join();
+
+    std::cout << batches << " batches added, " << snapshots
+              << " snapshots taken, " << failures << " inconsistent\n";
+    return failures ? 1 : 0;
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+}
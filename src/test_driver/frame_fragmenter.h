@@ -0,0 +1,42 @@
+#ifndef FRAME_FRAGMENTER_H
+#define FRAME_FRAGMENTER_H
+
+#include <algorithm>
+#include <array>
+#include <asio.hpp>
+#include <cstdint>
+
+#include "video_packet.h"
+
+// Splits a frame into the datagrams of the video protocol.
+class FrameFragmenter {
+  FragmentHeader header{};
+  const char *frame = nullptr;
+  uint16_t next_index = 0;
+
+public:
+  void reset(uint32_t frame_id, uint64_t capture_time_us, const char *data,
+             size_t size) {
+    header.frame_id = frame_id;
+    header.capture_time_us = capture_time_us;
+    header.fragment_count = std::max<size_t>(
+        1, (size + MAX_FRAGMENT_PAYLOAD_SZ - 1) / MAX_FRAGMENT_PAYLOAD_SZ);
+    header.frame_size = size;
+    frame = data;
+    next_index = 0;
+  }
+  bool done() const { return next_index == header.fragment_count; }
+  size_t fragment_count() const { return header.fragment_count; }
+  // the returned buffers stay valid until the next call
+  auto next_fragment() {
+    header.fragment_index = next_index++;
+    header.offset = header.fragment_index * MAX_FRAGMENT_PAYLOAD_SZ;
+    const size_t payload_size = std::min<size_t>(
+        MAX_FRAGMENT_PAYLOAD_SZ, header.frame_size - header.offset);
+    return std::array<asio::const_buffer, 2>{
+        asio::buffer(&header, sizeof(header)),
+        asio::buffer(frame + header.offset, payload_size)};
+  }
+};
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef JPEG_ENCODER_H
+#define JPEG_ENCODER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <jpge.h> // jpeg compression
+#include <memory>
+#include <vector>
+
+#include "jpeg_layout.h"
+
+struct Pixel {
+  unsigned char r, g, b;
+};
+struct ImageStorage {
+  size_t width, height;
+  std::unique_ptr<Pixel[]> data;
+
+  ImageStorage(size_t width = 0, size_t height = 0)
+      : width{width}, height{height}, data{std::make_unique<Pixel[]>(width *
+                                                                     height)} {}
+  ImageStorage(const ImageStorage &other)
+      : ImageStorage{other.width, other.height} {}
+
+  ImageStorage& operator=(ImageStorage &&) = default;
+};
+struct ImageCompressedStorage {
+  size_t capacity;
+  int stored_size;
+  std::unique_ptr<char[]> data;
+  size_t width, height;
+  // scratch of compress_image_with_restarts, kept for the next frame
+  std::vector<unsigned char> strip;
+
+  ImageCompressedStorage(size_t width = 0, size_t height = 0)
+      : capacity{width * height * 3},
+        stored_size{0}, data{std::make_unique<char[]>(capacity)}, width(width), height(height) {}
+  ImageCompressedStorage(const ImageCompressedStorage &other)
+      : ImageCompressedStorage{1, other.capacity / 3} {}
+
+  ImageCompressedStorage& operator=(ImageCompressedStorage&&) = default;
+
+};
+// jpge can't emit restart markers. Instead, strips of restart_rows MCU rows
+// are encoded one by one and stitched into a single JPEG with a restart
+// marker between consecutive strips. The encoder starts every strip in the
+// same state a restart marker would put it in, so the result is a valid
+// stream which the control center can decode strip by strip in parallel.
+inline bool compress_image_with_restarts(ImageCompressedStorage &out,
+                                         const ImageStorage &image,
+                                         jpge::params params,
+                                         size_t restart_rows) {
+  const size_t mcu_width = params.m_subsampling >= jpge::H2V1 ? 16 : 8;
+  const size_t mcu_height = params.m_subsampling == jpge::H2V2 ? 16 : 8;
+  // all strips have to use the same (standard) huffman tables
+  params.m_two_pass_flag = false;
+
+  const size_t strip_height = restart_rows * mcu_height;
+  const size_t interval =
+      restart_rows * ((image.width + mcu_width - 1) / mcu_width);
+  if (interval > UINT16_MAX)
+    return false;
+
+  auto *const data = reinterpret_cast<unsigned char *>(out.data.get());
+  size_t stored_size = 0;
+  auto append = [&](const unsigned char *bytes, size_t size) {
+    if (stored_size + size > out.capacity)
+      return false;
+    memcpy(data + stored_size, bytes, size);
+    stored_size += size;
+    return true;
+  };
+
+  auto &strip = out.strip;
+  strip.resize(image.width * strip_height * 3 + 1024);
+  for (size_t y = 0, idx = 0; y < image.height; y += strip_height, ++idx) {
+    int strip_size = strip.size();
+    if (!jpge::compress_image_to_jpeg_file_in_memory(
+            strip.data(), strip_size, image.width,
+            std::min(strip_height, image.height - y), 3,
+            reinterpret_cast<const jpge::uint8 *>(image.data.get() +
+                                                  y * image.width),
+            params))
+      return false;
+    const auto layout = parse_jpeg_layout({strip.data(), size_t(strip_size)});
+    if (!layout || strip[strip_size - 2] != 0xFF ||
+        strip[strip_size - 1] != 0xD9)
+      return false;
+
+    if (idx == 0) {
+      // headers of the first strip, extended to the height of the image
+      unsigned char dri[6] = {0xFF, 0xDD, 0x00, 0x04};
+      write_u16_be(dri + 4, interval);
+      if (!append(strip.data(), layout->sos_offset) ||
+          !append(dri, sizeof(dri)) ||
+          !append(strip.data() + layout->sos_offset,
+                  layout->scan_offset - layout->sos_offset))
+        return false;
+      write_u16_be(data + layout->sof_height_offset, image.height);
+    } else {
+      const unsigned char rst[2] = {
+          0xFF, static_cast<unsigned char>(0xD0 + (idx - 1) % 8)};
+      if (!append(rst, sizeof(rst)))
+        return false;
+    }
+    // entropy coded data without the EOI marker
+    if (!append(strip.data() + layout->scan_offset,
+                strip_size - layout->scan_offset - 2))
+      return false;
+  }
+
+  const unsigned char eoi[2] = {0xFF, 0xD9};
+  if (!append(eoi, sizeof(eoi)))
+    return false;
+  out.stored_size = stored_size;
+  return true;
+}
+inline bool compress_image(ImageCompressedStorage &out,
+                           const ImageStorage &image, size_t quality,
+                           size_t restart_rows) {
+  if (out.width != image.width || out.height != image.height)
+    out = ImageCompressedStorage(image.width, image.height);
+  out.stored_size = out.capacity;
+
+  auto params = jpge::params{};
+  params.m_quality = quality;
+  if (restart_rows)
+    return compress_image_with_restarts(out, image, params, restart_rows);
+  return jpge::compress_image_to_jpeg_file_in_memory(
+      out.data.get(), out.stored_size, image.width, image.height, 3,
+      reinterpret_cast<jpge::uint8 *>(image.data.get()), params);
+}
+// Averages blocks of 2^shift x 2^shift pixels.
+inline const ImageStorage &downscale(const ImageStorage &image,
+                                     ImageStorage &out, int shift) {
+  const size_t factor = size_t{1} << shift;
+  if (out.width != image.width / factor || out.height != image.height / factor)
+    out = ImageStorage(image.width / factor, image.height / factor);
+  for (size_t y = 0; y < out.height; ++y) {
+    for (size_t x = 0; x < out.width; ++x) {
+      unsigned r = 0, g = 0, b = 0;
+      for (size_t dy = 0; dy < factor; ++dy) {
+        const Pixel *row =
+            image.data.get() + (y * factor + dy) * image.width + x * factor;
+        for (size_t dx = 0; dx < factor; ++dx) {
+          r += row[dx].r;
+          g += row[dx].g;
+          b += row[dx].b;
+        }
+      }
+      const unsigned count = factor * factor;
+      out.data[y * out.width + x] = {static_cast<unsigned char>(r / count),
+                                     static_cast<unsigned char>(g / count),
+                                     static_cast<unsigned char>(b / count)};
+    }
+  }
+  return out;
+}
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef MJPEG_DEMUXER_H
+#define MJPEG_DEMUXER_H
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "jpeg_layout.h"
+
+// Splits a stream of concatenated JPEG images, as written by ffmpeg's
+// image2pipe muxer, into frames without copying them. Files are memory
+// mapped and replayed in a loop, standard input is read in large blocks.
+// The headers of every frame are walked to its entropy coded data, so that
+// thumbnails in APP segments can't be mistaken for frames, and the end of
+// the frame is found with memchr, which the C library vectorizes.
+class MjpegDemuxer {
+private:
+  static constexpr size_t block_size = 4 << 20;
+  // A frame without its end after this many bytes is taken to be corrupt,
+  // so that one doesn't make the buffer grow without bound.
+  static constexpr size_t max_frame_size = 32 << 20;
+
+  int fd;
+  bool mapped = false;
+  const unsigned char *data = nullptr;
+  size_t size = 0; // of the data available
+  size_t pos = 0;  // where the search for the next frame starts
+  bool found_frame = false;
+
+  // standard input only
+  std::unique_ptr<unsigned char[]> buffer;
+  size_t capacity = 0;
+  bool eof = false;
+
+  // offset of the next marker with the given second byte at or after from
+  std::optional<size_t> find_marker(size_t from, unsigned char marker) const {
+    while (from + 1 < size) {
+      auto p = static_cast<const unsigned char *>(
+          std::memchr(data + from, 0xFF, size - 1 - from));
+      if (!p)
+        return std::nullopt;
+      from = p - data;
+      if (p[1] == marker)
+        return from;
+      ++from;
+    }
+    return std::nullopt;
+  }
+
+  // Makes more data available, returns false if there is no more. Offsets
+  // into the data stay valid, spans handed out before don't.
+  bool fill() {
+    if (mapped || eof)
+      return false;
+    // drop what has been consumed, grow if a frame doesn't fit the buffer
+    std::memmove(buffer.get(), buffer.get() + pos, size - pos);
+    size -= pos;
+    pos = 0;
+    if (capacity - size < block_size / 2) {
+      auto grown = std::make_unique<unsigned char[]>(capacity * 2);
+      std::memcpy(grown.get(), buffer.get(), size);
+      buffer = std::move(grown);
+      capacity *= 2;
+    }
+    data = buffer.get();
+    const ssize_t bytes_read = ::read(fd, buffer.get() + size, capacity - size);
+    if (bytes_read <= 0) {
+      eof = true;
+      return false;
+    }
+    size += bytes_read;
+    return true;
+  }
+
+public:
+  // Reads from standard input if no path is given.
+  explicit MjpegDemuxer(const std::optional<std::string> &path) {
+    if (!path) {
+      fd = STDIN_FILENO;
+      capacity = block_size;
+      buffer = std::make_unique<unsigned char[]>(capacity);
+      data = buffer.get();
+      return;
+    }
+    fd = ::open(path->c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error("Could not open file");
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || info.st_size == 0) {
+      ::close(fd);
+      throw std::runtime_error("Could not read file");
+    }
+    void *map =
+        ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      ::close(fd);
+      throw std::runtime_error("Could not map file");
+    }
+    ::madvise(map, info.st_size, MADV_SEQUENTIAL);
+    mapped = true;
+    data = static_cast<const unsigned char *>(map);
+    size = info.st_size;
+  }
+  MjpegDemuxer(const MjpegDemuxer &) = delete;
+  MjpegDemuxer &operator=(const MjpegDemuxer &) = delete;
+  ~MjpegDemuxer() {
+    if (mapped) {
+      ::munmap(const_cast<unsigned char *>(data), size);
+      ::close(fd);
+    }
+  }
+
+  // Whether frames stay valid for as long as the demuxer, which they only
+  // do for files.
+  bool keeps_frames() const { return mapped; }
+
+  // Returns the next frame, which stays valid until the next call unless
+  // keeps_frames(), or nothing once standard input ends.
+  std::optional<std::span<const unsigned char>> next_frame() {
+    while (true) {
+      const auto soi = find_marker(pos, 0xD8);
+      if (!soi) {
+        // keep a trailing 0xFF, it could be the start of the marker
+        if (size)
+          pos = std::max(pos, size - 1);
+        if (fill())
+          continue;
+        if (!mapped || !found_frame)
+          return std::nullopt;
+        pos = 0; // replay the file
+        continue;
+      }
+      pos = *soi;
+
+      const std::span<const unsigned char> rest{data + pos, size - pos};
+      bool truncated;
+      const auto layout = parse_jpeg_layout(rest, &truncated);
+      if (!layout && !truncated) {
+        pos += 2; // corrupt headers, the next frame starts further on
+        continue;
+      }
+      const auto eoi =
+          layout ? find_marker(pos + layout->scan_offset, 0xD9) : std::nullopt;
+      if (!eoi) {
+        // the frame isn't complete yet, unless there is no more data or it
+        // already is too large to be a frame
+        if (size - pos > max_frame_size || !fill())
+          pos += 2;
+        continue;
+      }
+
+      const std::span<const unsigned char> frame{data + pos, *eoi + 2 - pos};
+      pos = *eoi + 2;
+      found_frame = true;
+      return frame;
+    }
+  }
+};
+
+#endif
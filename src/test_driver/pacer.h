@@ -0,0 +1,103 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+// Schedules datagrams so that they leave at a steady pace instead of in
+// bursts. Frames start at most frames_per_second times a second and
+// datagrams go through a token bucket that holds burst_bytes and fills at
+// bytes_per_second. The bucket is tracked as the time it would be empty
+// again, so the schedule only depends on the sizes of the datagrams as long
+// as the sender keeps up with it. Without a byte rate the datagrams of a
+// frame are spread evenly over the frame interval. A rate of 0 means no
+// limit. The schedule can be logged to replay a run, its times are counted
+// from the first datagram.
+class Pacer {
+  using clock = std::chrono::steady_clock;
+  using seconds = std::chrono::duration<double>;
+
+  const double bytes_per_second;
+  const clock::duration frame_interval;
+  const clock::duration burst;
+
+  clock::time_point bucket_empty{}; // once every token is spent
+  clock::time_point next_frame{};
+  clock::time_point next_datagram{};
+  clock::duration datagram_spacing{};
+  bool frame_started = false;
+  uint32_t frame_id = 0;
+
+  std::ostream *log = nullptr;
+  clock::time_point log_start{};
+
+public:
+  Pacer(double bytes_per_second, double frames_per_second, size_t burst_bytes)
+      : bytes_per_second{bytes_per_second},
+        frame_interval{frames_per_second > 0
+                           ? std::chrono::duration_cast<clock::duration>(
+                                 seconds{1 / frames_per_second})
+                           : clock::duration{}},
+        burst{bytes_per_second > 0
+                  ? std::chrono::duration_cast<clock::duration>(
+                        seconds{burst_bytes / bytes_per_second})
+                  : clock::duration{}} {}
+
+  // whether datagrams have to be scheduled, which they do for the log too
+  bool enabled() const {
+    return bytes_per_second > 0 || frame_interval > clock::duration{} || log;
+  }
+
+  // Writes a CSV line of frame id, bytes and send time in microseconds for
+  // every datagram scheduled from now on.
+  void log_schedule(std::ostream &out) {
+    log = &out;
+    *log << "frame_id,bytes,send_us\n";
+  }
+
+  // The next datagram starts frame id, made up of datagram_count datagrams.
+  void start_frame(uint32_t id, size_t datagram_count) {
+    frame_started = true;
+    frame_id = id;
+    datagram_spacing = {};
+    if (bytes_per_second == 0 && datagram_count > 0)
+      datagram_spacing = frame_interval / static_cast<int>(datagram_count);
+  }
+
+  // Returns when a datagram of the given size may be sent and accounts for
+  // it, datagrams have to be sent in the order they were scheduled.
+  clock::time_point schedule(size_t bytes) {
+    auto time = clock::now();
+    if (frame_started) {
+      // a frame that is late starts right away, it doesn't make up for it
+      time = std::max(time, next_frame);
+      next_frame = time + frame_interval;
+      next_datagram = time;
+      frame_started = false;
+    }
+    time = std::max(time, next_datagram);
+    next_datagram = time + datagram_spacing;
+
+    if (bytes_per_second > 0) {
+      time = std::max(time, bucket_empty - burst);
+      bucket_empty = std::max(bucket_empty, time) +
+                     std::chrono::duration_cast<clock::duration>(
+                         seconds{bytes / bytes_per_second});
+    }
+    if (log) {
+      if (log_start == clock::time_point{})
+        log_start = time;
+      *log << frame_id << ',' << bytes << ','
+           << std::chrono::duration_cast<std::chrono::microseconds>(
+                  time - log_start)
+                  .count()
+           << '\n';
+    }
+    return time;
+  }
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Bounded lock-free queue between exactly one producer and one consumer
+// thread. push and pop block while the queue is full or empty, close wakes
+// both sides up for good. finish lets the consumer drain the queue first.
+template <typename T, size_t Capacity> class SpscQueue {
+private:
+  std::array<T, Capacity> slots;
+  // both only ever grow, the slot is the index modulo Capacity
+  alignas(64) std::atomic<size_t> head{0}; // next to pop
+  alignas(64) std::atomic<size_t> tail{0}; // next to push
+  // changes with every push, pop and close, the blocked side waits on it
+  alignas(64) std::atomic<uint32_t> events{0};
+  std::atomic<bool> closed{false};
+  std::atomic<bool> finished{false};
+
+  void signal() {
+    events.fetch_add(1, std::memory_order_release);
+    events.notify_all();
+  }
+
+public:
+  // Returns false if the queue got closed.
+  bool push(const T &value) {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    while (true) {
+      const uint32_t seen = events.load(std::memory_order_acquire);
+      if (closed.load(std::memory_order_relaxed))
+        return false;
+      if (t - head.load(std::memory_order_acquire) < Capacity)
+        break;
+      events.wait(seen, std::memory_order_acquire);
+    }
+    slots[t % Capacity] = value;
+    tail.store(t + 1, std::memory_order_release);
+    signal();
+    return true;
+  }
+
+  // Returns false if the queue got closed, or finished and is empty.
+  bool pop(T &value) {
+    const size_t h = head.load(std::memory_order_relaxed);
+    while (true) {
+      const uint32_t seen = events.load(std::memory_order_acquire);
+      if (closed.load(std::memory_order_relaxed))
+        return false;
+      // read before tail, so that the last push is seen if it is set
+      const bool last = finished.load(std::memory_order_acquire);
+      if (tail.load(std::memory_order_acquire) != h)
+        break;
+      if (last)
+        return false;
+      events.wait(seen, std::memory_order_acquire);
+    }
+    value = slots[h % Capacity];
+    head.store(h + 1, std::memory_order_release);
+    signal();
+    return true;
+  }
+
+  void close() {
+    closed.store(true, std::memory_order_relaxed);
+    signal();
+  }
+  // From the producer, once it pushed its last value.
+  void finish() {
+    finished.store(true, std::memory_order_release);
+    signal();
+  }
+};
+
+#endif
@@ -2,20 +2,33 @@
 #include <asio.hpp> // network
 #include <atomic>
 #include <chrono>
+#include <cmath>
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
 #include <iomanip>
 #include <ios>
 #include <iostream>
-#include <istream>
-#include <jpge.h> // jpeg compression
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <span>
 #include <sstream>
 #include <stdexcept>
 #include <thread>
 #include <unistd.h>
+#include <vector>
+
+#include "frame_fragmenter.h"
+#include "jpeg_encoder.h"
+#include "jpeg_layout.h"
+#include "mjpeg_demuxer.h"
+#include "motor_packet.h"
+#include "pacer.h"
+#include "receiver_report.h"
+#include "sensor_packet.h"
+#include "spsc_queue.h"
+#include "video_packet.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h> // loading images from disk
@@ -24,47 +37,37 @@ namespace ip = asio::ip;
 using tcp = ip::tcp;
 using udp = ip::udp;
 
-struct Pixel {
-  unsigned char r, g, b;
-};
-struct ImageStorage {
-  size_t width, height;
-  std::unique_ptr<Pixel[]> data;
+class ImageLoader {
+  MjpegDemuxer demuxer;
+  size_t current_frame = 0;
 
-  ImageStorage(size_t width = 0, size_t height = 0)
-      : width{width}, height{height}, data{std::make_unique<Pixel[]>(width *
-                                                                     height)} {}
-  ImageStorage(const ImageStorage &other)
-      : ImageStorage{other.width, other.height} {}
+public:
+  // reads standard input if no path is given
+  explicit ImageLoader(const std::optional<std::string> &path)
+      : demuxer{path} {}
+  // Points out at the next JPEG of the input. Returns the index of the
+  // frame, counting from 1, or 0 once the input has ended. The frame stays
+  // valid until the next call, or for good if keeps_frames().
+  size_t load_next_frame(std::span<const unsigned char> &out) {
+    const auto frame = demuxer.next_frame();
+    if (!frame)
+      return 0;
+    out = *frame;
+    return ++current_frame;
+  }
+  // true for files, which are mapped into memory
+  bool keeps_frames() const { return demuxer.keeps_frames(); }
 
-  ImageStorage& operator=(ImageStorage &&) = default;
-};
-class ImageLoader {
-  int current_frame = 0;
-  std::istream &in;
-  std::vector<unsigned char> current_contents;
-  static constexpr unsigned char delim[] = {
-      0xFF, 0xD8, 0xFF, 0xE0, 0x00, 0x10, 0x4a, 0x46, 0x49, 0x46,
-      0x00, 0x01, 0x02, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00};
-  
-  static constexpr size_t delim_sz = sizeof(delim);
-
-  static constexpr size_t bufsz = 4096;
-  std::unique_ptr<unsigned char[]> intermediate =
-      std::make_unique<unsigned char[]>(bufsz);
-  std::unique_ptr<unsigned char[]> intermediate_next =
-      std::make_unique<unsigned char[]>(bufsz);
-  int i = 0;
-
-  void process_contents(ImageStorage &out) {
+  static bool decode(std::span<const unsigned char> frame, ImageStorage &out) {
     int read_width, read_height, read_components;
     auto read_image =
-        stbi_load_from_memory(current_contents.data(), current_contents.size(),
-                              &read_width, &read_height, &read_components, 3);
+        stbi_load_from_memory(frame.data(), frame.size(), &read_width,
+                              &read_height, &read_components, 3);
     if (!read_image || read_components != 3) {
       std::cerr << std::string("Could not read image. ") + stbi_failure_reason()
                 << '\n';
-      return;
+      stbi_image_free(read_image);
+      return false;
     }
     if (read_width != out.width || read_height != out.height)
       out = ImageStorage(read_width, read_height);
@@ -72,123 +75,456 @@ class ImageLoader {
     memcpy(static_cast<void *>(out.data.get()), read_image,
            out.width * out.height * 3);
     stbi_image_free(read_image);
+    return true;
+  }
+};
+// Picks the encoder settings from the receiver reports of the control
+// center. The bitrate budget backs off multiplicatively when a report shows
+// loss, jitter above the latency target or a receiver that can't keep up,
+// and grows back additively towards the target otherwise. The quality
+// follows the budget per frame within a dead band, so frame sizes settle
+// instead of oscillating. Once the quality hits its floor the frame rate and
+// then the resolution go down, and they come back in reverse order.
+class RateController {
+public:
+  struct Settings {
+    int quality;
+    int frame_divisor; // every nth source frame is sent
+    int scale_shift;   // the resolution is halved this many times
+  };
+
+private:
+  static constexpr int min_quality = 15, max_quality = 90, quality_step = 5;
+  static constexpr int max_frame_divisor = 3, max_scale_shift = 1;
+  using clock = std::chrono::steady_clock;
+
+  std::mutex mutex;
+  const double target_bps;
+  const double target_latency_ms;
+  double budget_bps;
+  Settings current{50, 1, 0};
+  double source_fps = 20;
+  clock::time_point last_sent_frame{};
+  bool has_report = false;
+  uint32_t last_sequence = 0;
+
+  double sent_fps() const { return source_fps / current.frame_divisor; }
+
+  void step_down() {
+    if (current.frame_divisor < max_frame_divisor)
+      ++current.frame_divisor;
+    else if (current.scale_shift < max_scale_shift)
+      ++current.scale_shift;
+  }
+  void step_up() {
+    if (current.scale_shift > 0)
+      --current.scale_shift;
+    else if (current.frame_divisor > 1)
+      --current.frame_divisor;
+  }
+
+public:
+  RateController(double target_bps, double target_latency_ms)
+      : target_bps{target_bps}, target_latency_ms{target_latency_ms},
+        budget_bps{target_bps / 2} {}
+
+  Settings settings() {
+    std::lock_guard lock{mutex};
+    return current;
+  }
+  // largest frame in bytes that doesn't make the quality go down
+  size_t max_frame_size() {
+    std::lock_guard lock{mutex};
+    return budget_bps / 8 / sent_fps() * 1.15;
+  }
+
+  // Once a frame is sent, frame_divisor is the one it was read with. The
+  // source rate follows from the rate frames go out at, reading the frames
+  // that are skipped doesn't take the time their source does.
+  void on_frame_sent(int frame_divisor) {
+    std::lock_guard lock{mutex};
+    const auto now = clock::now();
+    const double interval =
+        std::chrono::duration<double>(now - last_sent_frame).count();
+    if (interval > 0 && interval < 1)
+      source_fps += (frame_divisor / interval - source_fps) / 16;
+    last_sent_frame = now;
+  }
+
+  void on_frame_encoded(size_t bytes) {
+    std::lock_guard lock{mutex};
+    const double frame_budget = budget_bps / 8 / sent_fps();
+    if (bytes > frame_budget * 1.15) {
+      if (current.quality > min_quality)
+        current.quality -= quality_step;
+      else
+        step_down();
+    } else if (bytes < frame_budget * 0.75) {
+      if (current.quality < max_quality)
+        current.quality += quality_step;
+      else
+        step_up();
+    }
+  }
+
+  void on_report(const ReceiverReport &report) {
+    std::lock_guard lock{mutex};
+    const auto age = static_cast<int32_t>(report.sequence - last_sequence);
+    if (has_report && age <= 0)
+      return; // reordered
+    has_report = true;
+    last_sequence = report.sequence;
+
+    const uint32_t frames = report.frames_received + report.frames_lost;
+    const double loss = frames ? double(report.frames_lost) / frames : 0;
+    const bool congested =
+        loss > 0.02 || report.jitter_ms > target_latency_ms / 2;
+    if (congested) {
+      // back off from what actually got through
+      const double received_bps = report.bytes_per_second * 8.0;
+      budget_bps = std::max(std::min(budget_bps, received_bps) * 0.85,
+                            target_bps / 20);
+    } else {
+      budget_bps = std::min(budget_bps + target_bps / 20, target_bps);
+    }
+    // lowering the quality doesn't help a receiver that can't decode in time
+    if (report.decode_ms > 1000 / sent_fps() * 0.8)
+      step_down();
+  }
+};
+class ReportListener {
+  udp::socket socket;
+  udp::endpoint remote;
+  ReceiverReport report;
+  RateController &controller;
+
+  void receive() {
+    socket.async_receive_from(
+        asio::buffer(&report, sizeof(report)), remote,
+        [this](asio::error_code ec, std::size_t bytes_received) {
+          if (!ec && bytes_received == sizeof(report))
+            controller.on_report(report);
+          receive();
+        });
   }
 
 public:
-  ImageLoader(std::istream& in) : in{in} {
-    in.read((char *)intermediate.get(), bufsz);
-    in.read((char *)intermediate_next.get(), bufsz);
+  ReportListener(asio::io_context &ctx, RateController &controller,
+                 int stream)
+      : socket{ctx, udp::endpoint{udp::v4(), report_port(stream)}},
+        controller{controller} {
+    receive();
+  }
+};
+struct RawFrame {
+  std::span<const unsigned char> jpeg;
+  std::vector<unsigned char> storage; // of jpeg, if the input doesn't keep it
+  ImageStorage image;
+  uint32_t frame_id;
+  uint64_t capture_time_us;
+  RateController::Settings settings;
+  std::chrono::steady_clock::duration read_time;
+};
+struct EncodedFrame {
+  ImageStorage scaled;
+  ImageCompressedStorage compressed;
+  // the storage of a raw frame that is passed through, swapped in
+  std::vector<unsigned char> source;
+  // what is sent, in one of the above or in the mapped input
+  std::span<const unsigned char> jpeg;
+  size_t encoder;
+  bool passed_through;
+  int frame_divisor; // of the settings the frame was read with
+  uint32_t frame_id;
+  uint64_t capture_time_us;
+  std::chrono::steady_clock::duration read_time, encode_time;
+  std::chrono::steady_clock::time_point send_start;
+};
+// What the control center can decode, given its camera texture.
+struct ReceiverLimits {
+  size_t max_width, max_height;
+};
+// Loads, compresses and hands out frames in stages that run concurrently: a
+// reader thread demuxes the source frames, encoder_count workers transcode
+// them in parallel and the sender takes them in order. Frame n
+// always goes through encoder n % encoder_count, so the sender only has to
+// take the frames from the encoders round robin to keep them in order.
+// Frames travel through bounded queues as pointers to buffers that are
+// allocated up front and recycled through queues going the other way.
+class EncodePipeline {
+  static constexpr size_t depth = 2; // frames per encoder and stage
+  using clock = std::chrono::steady_clock;
+  struct Encoder {
+    std::array<RawFrame, depth> raw_frames;
+    std::array<EncodedFrame, depth> encoded_frames;
+    SpscQueue<RawFrame *, depth> raw, free_raw;
+    SpscQueue<EncodedFrame *, depth> encoded, free_encoded;
+    std::thread thread;
   };
-  size_t load_next_frame(ImageStorage &out) {
-    for (; true;) {
-      if (i == bufsz) {
-        swap(intermediate, intermediate_next);
-        in.read((char *)intermediate_next.get(), bufsz);
-        i = 0;
-        continue;
+
+  ImageLoader &loader;
+  RateController &rate_controller;
+  const size_t restart_rows;
+  const ReceiverLimits limits;
+  const bool passes_through;
+  std::vector<std::unique_ptr<Encoder>> encoders;
+  std::thread reader;
+
+  // sender side
+  size_t next_encoder = 0;
+  clock::time_point stats_start = clock::now();
+  size_t stats_frames = 0, stats_passed_through = 0;
+  clock::duration read_time{}, encode_time{}, send_time{};
+
+  void read() {
+    for (uint32_t frame_id = 0;; ++frame_id) {
+      auto &encoder = *encoders[frame_id % encoders.size()];
+      RawFrame *frame;
+      if (!encoder.free_raw.pop(frame))
+        return;
+      frame->settings = rate_controller.settings();
+      const auto start = clock::now();
+      // source frames the rate controller drops are read and skipped
+      size_t frame_idx;
+      do {
+        frame_idx = loader.load_next_frame(frame->jpeg);
+      } while (frame_idx % frame->settings.frame_divisor != 0);
+      if (frame_idx == 0) {
+        std::cout << "End of input\n";
+        // the encoders finish the frames they have, then the sender stops
+        for (auto &encoder : encoders)
+          encoder->raw.finish();
+        return;
       }
-      if (intermediate[i] == delim[0]) {
-        bool complete_match = true;
-        bool incomplete_match = false;
-        for (int j = i + 1; j < i + delim_sz; ++j) {
-          if (j == bufsz) {
-            complete_match = false;
-            incomplete_match = true;
-            break;
-          }
-          if (intermediate[j] != delim[j - i]) {
-            complete_match = false;
-            break;
-          }
-        }
-        if (complete_match) {
-          process_contents(out);
-          current_contents.clear();
-          current_contents.insert(current_contents.end(),
-                                  intermediate.get() + i,
-                                  intermediate.get() + i + delim_sz);
-          i = i + delim_sz;
-          return ++current_frame;
-        }
-        if (incomplete_match) {
-          size_t match_continue_pos = bufsz - i;
-          bool match = true;
-          for (int j = 0; j < delim_sz - match_continue_pos; ++j) {
-            if (intermediate_next[j] != delim[match_continue_pos + j])
-              match = false;
-            break;
-          }
-          if (match) {
-            process_contents(out);
-            current_contents.clear();
-            current_contents.insert(current_contents.end(),
-                                    intermediate.get() + i,
-                                    intermediate.get() + i + delim_sz);
-            i = delim_sz - match_continue_pos;
-            swap(intermediate, intermediate_next);
-            in.read((char *)intermediate_next.get(), bufsz);
-            return ++current_frame;
-          }
-        }
+      // only frames that are sent are copied, and only if they have to be
+      if (!loader.keeps_frames()) {
+        frame->storage.assign(frame->jpeg.begin(), frame->jpeg.end());
+        frame->jpeg = frame->storage;
       }
-      current_contents.push_back(intermediate[i]);
-      ++i;
+      const auto now = clock::now();
+      frame->read_time = now - start;
+      frame->capture_time_us =
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              now.time_since_epoch())
+              .count();
+      // ids of sent frames are consecutive, gaps mean loss
+      frame->frame_id = frame_id;
+      if (!encoder.raw.push(frame))
+        return;
     }
   }
-};
-constexpr size_t MAX_COMPRESSED_IMG_SZ = 65001;
-struct ImageCompressedStorage {
-  size_t capacity;
-  int stored_size;
-  std::unique_ptr<char[]> data;
-  int width, height;
 
-  ImageCompressedStorage(size_t width = 0, size_t height = 0)
-      : capacity{std::min(width * height * 3, MAX_COMPRESSED_IMG_SZ)},
-        stored_size{0}, data{std::make_unique<char[]>(capacity)}, width(width), height(height) {}
-  ImageCompressedStorage(const ImageCompressedStorage &other)
-      : ImageCompressedStorage{1, other.capacity / 3} {}
+  // Forwards the source JPEG as it is if the control center can decode it
+  // and it fits the bitrate budget. Frames of a file are sent from where it
+  // is mapped, the storage of others is handed over to out.
+  bool pass_through(RawFrame &raw, EncodedFrame &out) {
+    if (!passes_through || raw.settings.scale_shift)
+      return false;
+    const auto layout = parse_jpeg_layout(raw.jpeg);
+    const size_t max_size =
+        std::min(rate_controller.max_frame_size(),
+                 limits.max_width * limits.max_height * 3);
+    if (!layout || !layout->baseline ||
+        (layout->component_count != 1 && layout->component_count != 3) ||
+        layout->width > limits.max_width ||
+        layout->height > limits.max_height || raw.jpeg.size() > max_size)
+      return false;
+
+    if (loader.keeps_frames()) {
+      out.jpeg = raw.jpeg;
+    } else {
+      std::swap(out.source, raw.storage);
+      out.jpeg = out.source;
+    }
+    return true;
+  }
+
+  void transcode(RawFrame &raw, EncodedFrame &out) {
+    auto &compressed = out.compressed;
+    out.jpeg = {};
+    if (!ImageLoader::decode(raw.jpeg, raw.image))
+      return;
+    const auto &settings = raw.settings;
+    // frames larger than the receiver's texture are halved until they fit
+    int scale_shift = settings.scale_shift;
+    while ((raw.image.width >> scale_shift) > limits.max_width ||
+           (raw.image.height >> scale_shift) > limits.max_height)
+      ++scale_shift;
+    const ImageStorage &source =
+        scale_shift ? downscale(raw.image, out.scaled, scale_shift)
+                    : raw.image;
+    for (int quality = settings.quality;
+         !compress_image(compressed, source, quality, restart_rows);)
+      if (quality == 0) {
+        std::cerr << "Could not compress frame! Skipping!\n";
+        return;
+      } else
+        quality /= 2;
+    out.jpeg = {reinterpret_cast<const unsigned char *>(compressed.data.get()),
+                static_cast<size_t>(compressed.stored_size)};
+  }
+
+  void encode(Encoder &encoder) {
+    while (true) {
+      RawFrame *raw;
+      EncodedFrame *out;
+      if (!encoder.raw.pop(raw) || !encoder.free_encoded.pop(out)) {
+        encoder.encoded.finish();
+        return;
+      }
+      const auto start = clock::now();
+      out->passed_through = pass_through(*raw, *out);
+      if (!out->passed_through)
+        transcode(*raw, *out);
+      rate_controller.on_frame_encoded(out->jpeg.size());
+
+      out->frame_divisor = raw->settings.frame_divisor;
+      out->frame_id = raw->frame_id;
+      out->capture_time_us = raw->capture_time_us;
+      out->read_time = raw->read_time;
+      out->encode_time = clock::now() - start;
+      if (!encoder.free_raw.push(raw) || !encoder.encoded.push(out))
+        return;
+    }
+  }
+
+  void print_stats(clock::time_point now) {
+    using ms = std::chrono::duration<double, std::milli>;
+    const double seconds =
+        std::chrono::duration<double>(now - stats_start).count();
+    std::cout << std::fixed << std::setprecision(1)
+              << "Pipeline: " << stats_frames / seconds << " fps, read "
+              << ms{read_time}.count() / stats_frames << " ms, encode "
+              << ms{encode_time}.count() / stats_frames << " ms ("
+              << encoders.size() << " encoders, " << stats_passed_through
+              << " frames passed through), send "
+              << ms{send_time}.count() / stats_frames << " ms per frame\n";
+    stats_start = now;
+    stats_frames = stats_passed_through = 0;
+    read_time = encode_time = send_time = {};
+  }
+
+public:
+  // Frames are scaled down to fit the limits. Source frames the receiver can
+  // decode are passed through untouched if pass_through is set,
+  // restart_rows only applies to transcoded frames.
+  EncodePipeline(ImageLoader &loader, RateController &rate_controller,
+                 size_t restart_rows, size_t encoder_count,
+                 ReceiverLimits limits, bool pass_through)
+      : loader{loader}, rate_controller{rate_controller},
+        restart_rows{restart_rows}, limits{limits},
+        passes_through{pass_through} {
+    for (size_t i = 0; i < encoder_count; ++i) {
+      auto &encoder = *encoders.emplace_back(std::make_unique<Encoder>());
+      for (size_t j = 0; j < depth; ++j) {
+        encoder.free_raw.push(&encoder.raw_frames[j]);
+        encoder.encoded_frames[j].encoder = i;
+        encoder.free_encoded.push(&encoder.encoded_frames[j]);
+      }
+    }
+    for (auto &encoder : encoders)
+      encoder->thread = std::thread{[this, &worker = *encoder] {
+        encode(worker);
+      }};
+    reader = std::thread{[this] { read(); }};
+  }
+  ~EncodePipeline() {
+    for (auto &encoder : encoders) {
+      encoder->raw.close();
+      encoder->free_raw.close();
+      encoder->encoded.close();
+      encoder->free_encoded.close();
+    }
+    for (auto &encoder : encoders)
+      encoder->thread.join();
+    reader.join();
+  }
 
-  ImageCompressedStorage& operator=(ImageCompressedStorage&&) = default;
+  // Blocks until the next frame in order is encoded, returns nullptr once
+  // the input has ended. Only one thread at a time may send, frames have to
+  // be released in the order they were taken.
+  EncodedFrame *next() {
+    EncodedFrame *frame;
+    if (!encoders[next_encoder]->encoded.pop(frame))
+      return nullptr;
+    next_encoder = (next_encoder + 1) % encoders.size();
+    frame->send_start = clock::now();
+    return frame;
+  }
 
+  // Hands a frame back once all of it has been sent.
+  void release(EncodedFrame *frame) {
+    const auto now = clock::now();
+    rate_controller.on_frame_sent(frame->frame_divisor);
+    ++stats_frames;
+    stats_passed_through += frame->passed_through;
+    read_time += frame->read_time;
+    encode_time += frame->encode_time;
+    send_time += now - frame->send_start;
+    if (now - stats_start >= std::chrono::seconds{5})
+      print_stats(now);
+    encoders[frame->encoder]->free_encoded.push(frame);
+  }
 };
-bool compress_image(ImageCompressedStorage &out, const ImageStorage &image,
-                    size_t quality) {
-  if (out.width != image.width || out.height != image.height)
-    out = ImageCompressedStorage(image.width, image.height);
-  out.stored_size = out.capacity;
-
-  auto params = jpge::params{};
-  params.m_quality = quality;
-  return jpge::compress_image_to_jpeg_file_in_memory(
-      out.data.get(), out.stored_size, image.width, image.height, 3,
-      reinterpret_cast<jpge::uint8 *>(image.data.get()), params);
-}
 constexpr int MOTOR_TCP_PORT = 1333;
-constexpr int VIDEO_UDP_PORT = 1512;
 constexpr int SENSOR_UDP_PORT = 1666;
+// The motor commands that came in over either channel. Only the newest is
+// applied, the ones in between only count as received.
+class MotorState {
+  std::mutex mutex;
+  bool has_command = false;
+  uint32_t newest = 0; // sequence of the command applied last
+  uint32_t lost = 0;
+
+public:
+  // called when a new control center starts sending, it counts from 1
+  void reset() {
+    std::lock_guard lock{mutex};
+    has_command = false;
+    lost = 0;
+  }
+
+  // Takes the commands of one message, newest first with consecutive
+  // sequences, and returns the acknowledgement for the newest.
+  MotorAck apply(std::span<const MotorCommand> commands) {
+    std::lock_guard lock{mutex};
+    const auto &command = commands.front();
+    MotorAck ack{command.sequence, 0, command.send_time_us, 0, 0};
+    const auto ahead = static_cast<int32_t>(command.sequence - newest);
+    if (!has_command || ahead > 0) {
+      // the commands skipped that aren't repeated in this message
+      if (has_command)
+        lost += std::max<int64_t>(ahead - int64_t(commands.size()), 0);
+      has_command = true;
+      newest = command.sequence;
+      ack.applied = 1;
+      // TODO: change motor speed
+      // std::cout << "left motor: " << command.left_speed << std::endl;
+      // std::cout << "right motor: " << command.right_speed << std::endl;
+    }
+    ack.lost = lost;
+    return ack;
+  }
+};
 class TCPConnector {
   tcp::acceptor acceptor;
   ip::address &receiver;
+  MotorState &motors;
 
   void accept() { acceptor.async_accept(std::ref(*this)); }
   void on_connect() {
     std::cout << "Connected to remote: " << receiver << '\n';
   }
-  void on_receive(float left, float right) {
-    // TODO: change motor speed
-    // std::cout << "left motor: " << left << std::endl;
-    // std::cout << "right motor: " << right << std::endl;
-  }
   void on_disconnect() {
     receiver = ip::address{};
     std::cout << "Disconnected from remote\n";
   }
 
 public:
-  TCPConnector(asio::io_context &ctx, ip::address &receiver)
-      : acceptor{ctx, tcp::endpoint{tcp::v4(), MOTOR_TCP_PORT}}, receiver{
-                                                                     receiver} {
+  TCPConnector(asio::io_context &ctx, ip::address &receiver,
+               MotorState &motors)
+      : acceptor{ctx, tcp::endpoint{tcp::v4(), MOTOR_TCP_PORT}},
+        receiver{receiver}, motors{motors} {
     accept();
   }
 
@@ -197,15 +533,20 @@ public:
       on_connect();
 
       receiver = socket.remote_endpoint().address();
+      socket.set_option(tcp::no_delay{true});
+      motors.reset();
 
       while (true) {
-        float data[2];
+        MotorCommand command;
         asio::error_code ec;
-        socket.read_some(asio::buffer(data), ec);
+        asio::read(socket, asio::buffer(&command, sizeof(command)), ec);
 
         if (!ec) {
-          on_receive(data[0], data[1]);
-        } else {
+          // echoed right away, the control center measures the round trip
+          const MotorAck ack = motors.apply(std::span{&command, 1});
+          asio::write(socket, asio::buffer(&ack, sizeof(ack)), ec);
+        }
+        if (ec) {
           on_disconnect();
           accept();
           break;
@@ -214,73 +555,311 @@ public:
     }
   }
 };
+// The UDP counterpart of TCPConnector. Every datagram is acknowledged right
+// away to whoever sent it, and the sender becomes the receiver of the
+// video.
+class UDPMotorListener {
+  udp::socket socket;
+  udp::endpoint remote, last_remote;
+  MotorDatagram datagram;
+  ip::address &receiver;
+  MotorState &motors;
+
+  void receive() {
+    socket.async_receive_from(
+        asio::buffer(&datagram, sizeof(datagram)), remote,
+        [this](asio::error_code ec, std::size_t bytes_received) {
+          if (!ec)
+            on_datagram(bytes_received);
+          receive();
+        });
+  }
+  void on_datagram(size_t bytes_received) {
+    const auto commands = motor_commands(datagram, bytes_received);
+    if (commands.empty())
+      return;
+    if (remote != last_remote) {
+      last_remote = remote;
+      receiver = remote.address();
+      motors.reset();
+      std::cout << "Receiving motor commands from: " << remote << '\n';
+    }
+    const MotorAck ack = motors.apply(commands);
+    asio::error_code ec;
+    socket.send_to(asio::buffer(&ack, sizeof(ack)), remote, 0, ec);
+  }
+
+public:
+  UDPMotorListener(asio::io_context &ctx, ip::address &receiver,
+                   MotorState &motors)
+      : socket{ctx, udp::endpoint{udp::v4(), MOTOR_UDP_PORT}},
+        receiver{receiver}, motors{motors} {
+    receive();
+  }
+};
+// Sends whatever the generator returns, one datagram after the other, until
+// it returns nothing. The pacer holds every datagram back until its
+// scheduled time. Once the generator runs dry the io_context is stopped.
 template <typename TransmissionGenerator> class UDPTransmitter {
+  asio::io_context &ctx;
   ip::address &receiver;
   udp::socket socket;
+  asio::steady_timer timer;
   const uint16_t port;
+  Pacer &pacer;
   TransmissionGenerator generator;
 
-  void transmit() {
+  template <typename Buffers> void send(const Buffers &buffers) {
     socket.async_send_to(
-        generator(), {receiver, port}, [&](asio::error_code ec, std::size_t b) {
+        buffers, {receiver, port}, [&](asio::error_code ec, std::size_t b) {
           if (ec)
             std::cerr << " ec: " << ec << " " << ec.message() << std::endl;
           transmit();
         });
   }
 
+  void transmit() {
+    const auto buffers = generator();
+    if (!buffers) {
+      ctx.stop();
+      return;
+    }
+    if (!pacer.enabled()) {
+      send(*buffers);
+      return;
+    }
+    timer.expires_at(pacer.schedule(asio::buffer_size(*buffers)));
+    timer.async_wait(
+        [this, buffers = *buffers](asio::error_code) { send(buffers); });
+  }
+
 public:
   UDPTransmitter(asio::io_context &ctx, ip::address &receiver, uint16_t port,
-                 TransmissionGenerator &&generator)
-      : receiver{receiver}, socket{ctx}, port{port}, generator{
-                                                         std::move(generator)} {
+                 Pacer &pacer, TransmissionGenerator &&generator)
+      : ctx{ctx}, receiver{receiver}, socket{ctx}, timer{ctx}, port{port},
+        pacer{pacer}, generator{std::move(generator)} {
     socket.open(udp::v4());
     socket.set_option(asio::socket_base::broadcast(true));
     transmit();
   }
 };
 
-struct Message {
-  float water_temperature;
-  float turbidity;
-  float dust;
-  float battery_voltage;
-  float pressure;
-  float temperature;
-  float humidity;
+// Simulates the sensors of the vehicle, each sampled at its own rate, and
+// sends their samples in batches every batch_interval.
+class SensorTransmitter {
+  using clock = std::chrono::steady_clock;
+  static constexpr clock::duration batch_interval =
+      std::chrono::milliseconds{20};
+  struct Sensor {
+    SensorType type;
+    double rate_hz;
+    float base, amplitude;
+    clock::duration period{};
+    clock::time_point next_sample{};
+  };
+
+  ip::address &receiver;
+  udp::socket socket;
+  asio::steady_timer timer;
+  std::array<Sensor, 7> sensors{{
+      {SensorType::WaterTemperature, 2, 12, 2},
+      {SensorType::WaterTurbidity, 10, 5, 3},
+      {SensorType::Dust, 10, 30, 10},
+      {SensorType::AtmosphericPressure, 50, 1013, 5},
+      {SensorType::AtmosphericTemperature, 10, 20, 3},
+      {SensorType::AtmosphericHumidity, 5, 60, 10},
+      {SensorType::BatteryVoltage, 200, 12.2f, 0.4f},
+  }};
+  SensorBatch batch{};
+  uint32_t sequence = 0;
+
+  void flush() {
+    if (batch.header.sample_count == 0)
+      return;
+    batch.header.version = SENSOR_PROTOCOL_VERSION;
+    batch.header.sequence = sequence++;
+    if (!receiver.is_unspecified()) {
+      asio::error_code ec;
+      socket.send_to(asio::buffer(&batch, batch.size()),
+                     udp::endpoint{receiver, SENSOR_UDP_PORT}, 0, ec);
+    }
+    batch.header.sample_count = 0;
+  }
+
+  void sample(clock::time_point now) {
+    for (auto &sensor : sensors) {
+      // don't make up for samples missed while the process was stopped
+      if (now - sensor.next_sample > std::chrono::seconds{1})
+        sensor.next_sample = now;
+      for (; sensor.next_sample <= now; sensor.next_sample += sensor.period) {
+        const auto time_us =
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                sensor.next_sample.time_since_epoch())
+                .count();
+        const double phase = static_cast<double>(sensor.type);
+        const float value =
+            sensor.base +
+            sensor.amplitude * std::sin(time_us * 1e-6 / phase + phase);
+        if (batch.header.sample_count == MAX_SENSOR_BATCH_SZ)
+          flush();
+        batch.samples[batch.header.sample_count++] = {
+            static_cast<uint64_t>(time_us), sensor.type, value};
+      }
+    }
+    flush();
+  }
+
+  void tick() {
+    timer.expires_at(timer.expiry() + batch_interval);
+    timer.async_wait([this](asio::error_code ec) {
+      if (ec)
+        return;
+      sample(clock::now());
+      tick();
+    });
+  }
+
+public:
+  // rate_scale multiplies the sample rates of all sensors
+  SensorTransmitter(asio::io_context &ctx, ip::address &receiver,
+                    double rate_scale)
+      : receiver{receiver}, socket{ctx}, timer{ctx} {
+    socket.open(udp::v4());
+    const auto now = clock::now();
+    for (auto &sensor : sensors) {
+      sensor.period = std::chrono::duration_cast<clock::duration>(
+          std::chrono::duration<double>{1 / (sensor.rate_hz * rate_scale)});
+      sensor.next_sample = now;
+    }
+    timer.expires_at(now);
+    tick();
+  }
+};
+
+struct Options {
+  std::optional<std::string> input; // stdin if not set
+  size_t restart_rows = 0;          // MCU rows per restart interval, 0 = none
+  double target_mbps = 10;
+  double target_latency_ms = 100;
+  size_t encoders = std::max(std::thread::hardware_concurrency(), 3u) - 2;
+  bool pass_through = false;
+  double pace_mbps = 0; // 0 = as fast as frames get encoded
+  double pace_fps = 0;
+  double sensor_rate_scale = 1;
+  // CSV file the send time of every video datagram is written to
+  std::optional<std::string> schedule_log;
+  // the size of the control center's camera texture
+  ReceiverLimits receiver_limits{1280, 720};
+  // The camera this instance stands in for, sent to video_port(stream). Only
+  // stream 0 simulates the rest of the vehicle, the others send video only,
+  // to the receiver given or to where stream 0 sends.
+  int stream = 0;
+  std::optional<std::string> receiver;
 };
+Options parse_options(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (arg == "--restart-rows" && i + 1 < argc)
+      options.restart_rows = std::stoul(argv[++i]);
+    else if (arg == "--target-mbps" && i + 1 < argc)
+      options.target_mbps = std::stod(argv[++i]);
+    else if (arg == "--target-latency-ms" && i + 1 < argc)
+      options.target_latency_ms = std::stod(argv[++i]);
+    else if (arg == "--encoders" && i + 1 < argc)
+      options.encoders = std::max<size_t>(std::stoul(argv[++i]), 1);
+    else if (arg == "--pace-mbps" && i + 1 < argc)
+      options.pace_mbps = std::stod(argv[++i]);
+    else if (arg == "--pace-fps" && i + 1 < argc)
+      options.pace_fps = std::stod(argv[++i]);
+    else if (arg == "--schedule-log" && i + 1 < argc)
+      options.schedule_log = argv[++i];
+    else if (arg == "--sensor-rate-scale" && i + 1 < argc)
+      options.sensor_rate_scale = std::max(std::stod(argv[++i]), 0.01);
+    else if (arg == "--stream" && i + 1 < argc)
+      options.stream = std::clamp(std::stoi(argv[++i]), 0,
+                                  MAX_VIDEO_STREAMS - 1);
+    else if (arg == "--receiver" && i + 1 < argc)
+      options.receiver = argv[++i];
+    else if (arg == "--pass-through")
+      options.pass_through = true;
+    else if (arg == "--max-width" && i + 1 < argc)
+      options.receiver_limits.max_width = std::stoul(argv[++i]);
+    else if (arg == "--max-height" && i + 1 < argc)
+      options.receiver_limits.max_height = std::stoul(argv[++i]);
+    else
+      options.input = arg;
+  }
+  return options;
+}
 
 // use with
 // ffmpeg -y -f avfoundation -framerate 30 -i "0" -preset ultrafast -r 20 -f
 // image2pipe - |
-// ./test_driver
+// ./test_driver [--restart-rows N] [--target-mbps X] [--target-latency-ms X]
+// [--encoders N] [--pass-through] [--max-width N] [--max-height N]
+// [--pace-mbps X] [--pace-fps X] [--schedule-log FILE]
+// [--sensor-rate-scale X] [--stream N] [--receiver ADDRESS] [file]
 int main(int argc, char **argv) {
   try {
     asio::io_context ctx;
+    const Options options = parse_options(argc, argv);
 
-    auto in = (argc == 1 ? std::nullopt : std::optional<std::ifstream>{std::in_place, argv[1], std::ios_base::binary});
-    if (in.has_value() && !*in)
-      throw std::runtime_error("Could not open file");
-    ImageLoader loader{[&]()->std::istream&{ if(in.has_value()) return *in; else return std::cin;  }()};
+    ImageLoader loader{options.input};
 
     ip::address receiver;
-    TCPConnector connector{ctx, receiver};
+    if (options.receiver)
+      receiver = ip::make_address(*options.receiver);
+    // the ports of the vehicle can only be taken once per host
+    const bool vehicle = options.stream == 0;
+    MotorState motors;
+    std::optional<TCPConnector> connector;
+    std::optional<UDPMotorListener> motor_listener;
+    if (vehicle) {
+      connector.emplace(ctx, receiver, motors);
+      motor_listener.emplace(ctx, receiver, motors);
+    }
 
+    RateController rate_controller{options.target_mbps * 1e6,
+                                   options.target_latency_ms};
+    ReportListener report_listener{ctx, rate_controller, options.stream};
+
+    EncodePipeline pipeline{
+        loader, rate_controller, options.restart_rows, options.encoders,
+        options.receiver_limits, options.pass_through};
+    std::optional<SensorTransmitter> sensor_transmitter;
+    if (vehicle)
+      sensor_transmitter.emplace(ctx, receiver, options.sensor_rate_scale);
+
+    Pacer video_pacer{options.pace_mbps * 1e6 / 8, options.pace_fps,
+                      8 * MAX_VIDEO_DATAGRAM_SZ};
+    std::ofstream schedule_log;
+    if (options.schedule_log) {
+      schedule_log.open(*options.schedule_log);
+      if (!schedule_log)
+        throw std::runtime_error("Could not open " + *options.schedule_log);
+      video_pacer.log_schedule(schedule_log);
+    }
     UDPTransmitter video_transmitter{
-        ctx, receiver, VIDEO_UDP_PORT,
-        [frame_idx = 0, &loader, image = ImageStorage{},
-         compressed = ImageCompressedStorage{}]() mutable {
-          frame_idx = loader.load_next_frame(image);
-          for (int quality = 50; !compress_image(compressed, image, quality);)
-            if (quality == 0) {
-                std::cerr << "Could not compress frame! Skipping!\n";
-                break;            
-              }
-            else
-              quality /= 2;
-          return std::array{
-              asio::buffer(&frame_idx, sizeof(frame_idx)),
-              asio::buffer(compressed.data.get(), compressed.stored_size)};
+        ctx, receiver, video_port(options.stream), video_pacer,
+        [&pipeline, &video_pacer, fragmenter = FrameFragmenter{},
+         frame = static_cast<EncodedFrame *>(nullptr)]() mutable
+        -> std::optional<std::array<asio::const_buffer, 2>> {
+          if (fragmenter.done()) {
+            // the previous call returned the last fragment, which is sent now
+            if (frame)
+              pipeline.release(frame);
+            frame = pipeline.next();
+            if (!frame)
+              return std::nullopt; // end of input
+            fragmenter.reset(
+                frame->frame_id, frame->capture_time_us,
+                reinterpret_cast<const char *>(frame->jpeg.data()),
+                frame->jpeg.size());
+            video_pacer.start_frame(frame->frame_id,
+                                    fragmenter.fragment_count());
+          }
+          return fragmenter.next_fragment();
         }};
 
     std::thread worker1{[&] { ctx.run(); }};